@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Writes the trace of an application that records it with the collector parameter set.
+ *
+ * The application only sends what it records through shared memory: this process replays it in
+ * ThreadWriters and writes the trace. It exits once the application is gone, even if it crashed,
+ * after writing everything that was sent until then.
+ */
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cinttypes>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_collector.h"
+#include "htf/htf_parameter_handler.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+/** How long the collector sleeps when all the rings are empty. */
+#define COLLECTOR_IDLE_WAIT std::chrono::microseconds(100)
+
+/** A ThreadWriter of the application, and the ring through which it sends its Events. */
+struct CollectedThread {
+  std::string ring_name;          /**< Name of the shared memory of #ring. */
+  SharedRing* ring;               /**< Ring of the ThreadWriter. */
+  ThreadWriter* writer;           /**< ThreadWriter in which the Events are replayed. */
+  std::vector<TokenId> templates; /**< Ids of the Events registered with htf_register_event_template. */
+  bool closed;                    /**< Whether the application closed the ThreadWriter. */
+};
+
+static const char* collector_name = nullptr;
+/** Archives of the application, by key. */
+static std::map<uint64_t, Archive*> archives;
+/** ThreadWriters of the application, by ring index. */
+static std::map<uint32_t, CollectedThread> threads;
+
+static Archive* get_archive(uint64_t key) {
+  auto it = archives.find(key);
+  if (it == archives.end())
+    htf_error("Unknown archive %" PRIx64 "\n", key);
+  return it->second;
+}
+
+/** Copies the AttributeList that follows a message, if there is one. */
+static AttributeList* read_attribute_list(const uint8_t* data, uint16_t size, AttributeList* buffer) {
+  if (size == 0)
+    return nullptr;
+  memcpy(buffer, data, size);
+  return buffer;
+}
+
+/** Copies the Event that follows a message. */
+static void read_event(const uint8_t* data, Event* e) {
+  memcpy(e, data, offsetof(Event, event_data));
+  memcpy(e, data, e->event_size);
+}
+
+static void close_thread(CollectedThread& t) {
+  htf_write_thread_close(t.writer);
+  delete t.writer;
+  closeSharedRing(t.ring);
+  shm_unlink(t.ring_name.c_str());
+}
+
+/** Replays the messages of a ThreadWriter. */
+static size_t drain_thread(CollectedThread& t) {
+  return t.ring->drain([&t](const CollectorMessage* message) {
+    AttributeList attributes;
+    switch (message->type) {
+    case CollectorMessageType::Event: {
+      auto* m = reinterpret_cast<const EventMessage*>(message);
+      auto* data = reinterpret_cast<const uint8_t*>(m + 1);
+      Event e;
+      read_event(data, &e);
+      AttributeList* attribute_list = read_attribute_list(data + e.event_size, m->attribute_size, &attributes);
+      t.writer->recordEncodedEvent((enum EventType)m->event_type, &e, m->ts, attribute_list);
+      break;
+    }
+    case CollectorMessageType::EventTemplate: {
+      auto* m = reinterpret_cast<const EventTemplateMessage*>(message);
+      Event e;
+      read_event(reinterpret_cast<const uint8_t*>(m + 1), &e);
+      htf_assert(m->template_id == t.templates.size());
+      t.templates.push_back(
+        htf_register_event_template(t.writer, e.record, e.event_data, e.event_size - offsetof(Event, event_data)));
+      break;
+    }
+    case CollectorMessageType::EventById: {
+      auto* m = reinterpret_cast<const EventByIdMessage*>(message);
+      auto* data = reinterpret_cast<const uint8_t*>(m + 1);
+      AttributeList* attribute_list = read_attribute_list(data, m->attribute_size, &attributes);
+      t.writer->recordEvent((enum EventType)m->event_type, t.templates.at(m->template_id), m->ts, attribute_list);
+      break;
+    }
+    case CollectorMessageType::MeasurementOnOff: {
+      auto* m = reinterpret_cast<const MeasurementOnOffMessage*>(message);
+      t.writer->recordMeasurementOnOff((enum MeasurementMode)m->mode, m->ts, m->nb_closed, m->nb_opened);
+      break;
+    }
+    case CollectorMessageType::ThreadClose:
+      // The ring is still being read: the ThreadWriter is closed once it is drained.
+      t.closed = true;
+      break;
+    default:
+      htf_error("Unexpected message %u in the ring %s\n", (unsigned)message->type, t.ring_name.c_str());
+    }
+  });
+}
+
+/** Replays the messages of all the ThreadWriters that are still open. */
+static size_t drain_threads() {
+  size_t nb_messages = 0;
+  for (auto it = threads.begin(); it != threads.end();) {
+    nb_messages += drain_thread(it->second);
+    if (it->second.closed) {
+      close_thread(it->second);
+      it = threads.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return nb_messages;
+}
+
+/** Replays a message of the control ring. */
+static void handle_control_message(const CollectorMessage* message) {
+  switch (message->type) {
+  case CollectorMessageType::ArchiveOpen: {
+    auto* m = reinterpret_cast<const ArchiveOpenMessage*>(message);
+    auto* dir_name = reinterpret_cast<const char*>(m + 1);
+    const char* trace_name = dir_name + m->dir_name_size;
+    Archive* archive = htf_archive_new();
+    if (m->id == HTF_MAIN_LOCATION_GROUP_ID)
+      htf_write_global_archive_open(archive, dir_name, trace_name);
+    else
+      htf_write_archive_open(archive, dir_name, trace_name, m->id);
+    archives[m->archive] = archive;
+    break;
+  }
+  case CollectorMessageType::ArchiveClose: {
+    auto* m = reinterpret_cast<const ArchiveCloseMessage*>(message);
+    // The application closed its threads before the Archive: their last Events are already in their rings.
+    drain_threads();
+    htf_write_archive_close(get_archive(m->archive));
+    archives.erase(m->archive);
+    break;
+  }
+  case CollectorMessageType::Clock: {
+    auto* m = reinterpret_cast<const ClockMessage*>(message);
+    // The Archives are written with the clock of the application, even by close_everything if it crashed.
+    htf_set_clock_info(&m->clock);
+    break;
+  }
+  case CollectorMessageType::String: {
+    auto* m = reinterpret_cast<const StringMessage*>(message);
+    htf_archive_register_string(get_archive(m->archive), m->string_ref, reinterpret_cast<const char*>(m + 1));
+    break;
+  }
+  case CollectorMessageType::Region: {
+    auto* m = reinterpret_cast<const RegionMessage*>(message);
+    htf_archive_register_region(get_archive(m->archive), m->region_ref, m->string_ref);
+    break;
+  }
+  case CollectorMessageType::Attribute: {
+    auto* m = reinterpret_cast<const AttributeMessage*>(message);
+    htf_archive_register_attribute(get_archive(m->archive), m->attribute_ref, m->name, m->description,
+                                   m->attribute_type);
+    break;
+  }
+  case CollectorMessageType::LocationGroup: {
+    auto* m = reinterpret_cast<const LocationMessage<CollectorMessageType::LocationGroup>*>(message);
+    htf_write_define_location_group(get_archive(m->archive), m->id, m->name, m->parent);
+    break;
+  }
+  case CollectorMessageType::Location: {
+    auto* m = reinterpret_cast<const LocationMessage<CollectorMessageType::Location>*>(message);
+    htf_write_define_location(get_archive(m->archive), m->id, m->name, m->parent);
+    break;
+  }
+  case CollectorMessageType::ThreadOpen: {
+    auto* m = reinterpret_cast<const ThreadOpenMessage*>(message);
+    CollectedThread& t = threads[m->ring_index];
+    t.ring_name = sharedRingName(collector_name, m->ring_index);
+    t.ring = openSharedRing(t.ring_name);
+    if (!t.ring)
+      htf_error("Cannot open the ring %s\n", t.ring_name.c_str());
+    t.writer = new ThreadWriter();
+    t.closed = false;
+    htf_write_thread_open(get_archive(m->archive), t.writer, m->thread_id);
+    break;
+  }
+  default:
+    htf_error("Unexpected message %u in the control ring\n", (unsigned)message->type);
+  }
+}
+
+/** Writes what the application did not close before it exited. */
+static void close_everything() {
+  for (auto& [index, t] : threads) {
+    htf_warn("Thread %u was not closed by the application\n", t.writer->thread_trace.id);
+    close_thread(t);
+  }
+  threads.clear();
+  // The global Archive is written last, once every other one is.
+  Archive* global_archive = nullptr;
+  for (auto& [key, archive] : archives) {
+    if (archive->id == HTF_MAIN_LOCATION_GROUP_ID) {
+      global_archive = archive;
+      continue;
+    }
+    htf_warn("Archive %u was not closed by the application\n", archive->id);
+    htf_write_archive_close(archive);
+  }
+  if (global_archive) {
+    htf_warn("The global archive was not closed by the application\n");
+    htf_write_global_archive_close(global_archive);
+  }
+  archives.clear();
+}
+
+void usage(const char* prog_name) {
+  printf("Usage: %s [OPTION] [collector_name]\n", prog_name);
+  printf("Writes the trace of the application started with HTF_COLLECTOR=collector_name.\n");
+  printf("By default, collector_name is the collector parameter of HTF.\n");
+  printf("\t-v          Verbose mode\n");
+  printf("\t-?  -h      Display this help and exit\n");
+}
+
+int main(int argc, char** argv) {
+  int nb_opts = 0;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v")) {
+      htf_debug_level_set(DebugLevel::Verbose);
+      nb_opts++;
+    } else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "-?")) {
+      usage(argv[0]);
+      return EXIT_SUCCESS;
+    } else {
+      break;
+    }
+  }
+  collector_name = argc > nb_opts + 1 ? argv[nb_opts + 1] : parameterHandler.getCollector();
+  if (!collector_name) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  // This process writes the trace itself.
+  CollectorClient::disable();
+
+  std::string control_name = sharedRingName(collector_name, 0);
+  SharedRing* control;
+  while (!(control = openSharedRing(control_name)))
+    std::this_thread::sleep_for(COLLECTOR_IDLE_WAIT);
+  pid_t application = control->producer;
+  htf_log(DebugLevel::Verbose, "Collecting the trace of process %d\n", application);
+
+  // The trace directories given by the application are relative to its own working directory.
+  char application_cwd[PATH_MAX];
+  std::string cwd_link = "/proc/" + std::to_string(application) + "/cwd";
+  ssize_t len = readlink(cwd_link.c_str(), application_cwd, sizeof(application_cwd) - 1);
+  if (len > 0) {
+    application_cwd[len] = '\0';
+    if (chdir(application_cwd) < 0)
+      htf_warn("Cannot move to the working directory of the application %s\n", application_cwd);
+  }
+
+  while (true) {
+    // Whatever the application sent before exiting is in the rings once it is gone.
+    bool application_alive = kill(application, 0) == 0 || errno != ESRCH;
+    size_t nb_messages = control->drain(handle_control_message);
+    nb_messages += drain_threads();
+    if (!application_alive)
+      break;
+    if (nb_messages == 0)
+      std::this_thread::sleep_for(COLLECTOR_IDLE_WAIT);
+  }
+
+  close_everything();
+  closeSharedRing(control);
+  shm_unlink(control_name.c_str());
+  htf_log(DebugLevel::Verbose, "Process %d is gone, the trace is written\n", application);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
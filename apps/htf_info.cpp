@@ -2,11 +2,13 @@
  * Copyright (C) Telecom SudParis
  * See LICENSE in top-level directory.
  */
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
 
 #include "htf/htf.h"
 #include "htf/htf_archive.h"
+#include "htf/htf_parameter_handler.h"
 #include "htf/htf_read.h"
 #include "htf/htf_storage.h"
 
@@ -28,7 +30,15 @@ void print_sequence(Thread* t, Sequence* s) {
 
 void info_event(Thread* t, EventSummary* e) {
   htf_print_event(t, &e->event);
-  printf("\t{.nb_events: %zu}\n", e->durations->size);
+  printf("\t{.nb_events: %zu", e->durations->size);
+  if (e->volatile_fields)
+    printf(", .volatile_fields: %s", volatileFieldsToString(e->volatile_fields).c_str());
+  if (e->aggregated_calls)
+    printf(", .aggregated_calls: {.nb_calls: %zu, .total_duration: %" PRIu64 ", .min_duration: %" PRIu64
+           ", .max_duration: %" PRIu64 "}",
+           e->aggregated_calls->nb_calls, e->aggregated_calls->total_duration, e->aggregated_calls->min_duration,
+           e->aggregated_calls->max_duration);
+  printf("}\n");
 }
 
 void info_sequence(Sequence* s) {
@@ -67,6 +77,26 @@ void info_thread(Thread* t) {
     printf("\t\tL%x\t", i);
     info_loop(&t->loops[i]);
   }
+
+  if (t->nb_max_loop_lengths) {
+    printf("\tMax loop lengths {.nb_levels: %u}: [", t->nb_max_loop_lengths);
+    for (unsigned i = 0; i < t->nb_max_loop_lengths; i++)
+      printf(i ? ", %zu" : "%zu", t->max_loop_lengths[i]);
+    printf("]\n");
+  }
+
+  if (t->degradations) {
+    printf("\tDegradations {.nb_dropped_attributes: %zu}:", t->nb_dropped_attributes);
+    if (t->degradations & HTF_DEGRADATION_FLAT_SEQUENCES)
+      printf(" flat_sequences");
+    if (t->degradations & HTF_DEGRADATION_PAYLOAD_COLUMNS)
+      printf(" payload_columns");
+    if (t->degradations & HTF_DEGRADATION_DROPPED_ATTRIBUTES)
+      printf(" dropped_attributes");
+    printf("\n");
+  }
+  if (t->nb_late_events)
+    printf("\tLate events {.nb_late_events: %zu}\n", t->nb_late_events);
 }
 
 void info_archive(Archive* archive) {
@@ -76,6 +106,9 @@ void info_archive(Archive* archive) {
   printf("\tfullpath:   %s\n", archive->fullpath);
   printf("\n");
   printf("\tglobal_archive: %x\n", archive->global_archive ? (int)archive->global_archive->id : -1);
+  printf("\tclock {.source: %s, .resolution: %lf ns, .ns_per_tick: %lf}\n",
+         algorithmToString(static_cast<ClockSource>(archive->clock.source)).c_str(), archive->clock.resolution,
+         archive->clock.ns_per_tick);
 
   printf("\tStrings {.nb_strings: %zu } :\n", archive->definitions.strings.size());
   for (auto& string : archive->definitions.strings) {
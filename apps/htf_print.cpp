@@ -8,6 +8,7 @@
 #include "htf/htf.h"
 #include "htf/htf_archive.h"
 #include "htf/htf_read.h"
+#include "htf/htf_record.h"
 #include "htf/htf_storage.h"
 
 static bool show_structure = false;
@@ -63,7 +64,14 @@ static void print_event(const std::string& current_indent,
     thread->printToken(token);
     std::cout << "\t";
   }
-  thread->printEvent(e->event);
+  if (e->volatile_values) {
+    // Print the Event as it was recorded, with the values of this occurence.
+    htf::Event event = *e->event;
+    htf::restoreVolatileFields(&event, thread->getEventSummary(token)->volatile_fields, e->volatile_values);
+    thread->printEvent(&event);
+  } else {
+    thread->printEvent(e->event);
+  }
   thread->printEventAttribute(e);
   std::cout << std::endl;
 }
@@ -231,6 +239,29 @@ static void display_sequence(htf::ThreadReader* reader,
   reader->leaveBlock();
 }
 
+/* Print the calls that were aggregated instead of being recorded one by one */
+static void print_aggregated_calls(htf::Thread** threads, int nb_threads) {
+  bool header_printed = false;
+  for (int i = 0; i < nb_threads; i++) {
+    htf::Thread* thread = threads[i];
+    for (unsigned j = 0; j < thread->nb_events; j++) {
+      htf::EventSummary* es = &thread->events[j];
+      const htf::AggregatedCalls* calls = es->aggregated_calls;
+      if (!calls || calls->nb_calls == 0)
+        continue;
+      if (!header_printed) {
+        printf("Aggregated calls:\n");
+        header_printed = true;
+      }
+      if (!per_thread)
+        std::cout << thread->getName() << "\t";
+      thread->printEvent(&es->event);
+      printf("\t%zu calls, total %.9lf, min %.9lf, max %.9lf\n", calls->nb_calls, calls->total_duration / 1e9,
+             calls->min_duration / 1e9, calls->max_duration / 1e9);
+    }
+  }
+}
+
 /* Print all the events of a thread */
 static void print_thread(htf::Archive& trace, htf::Thread* thread) {
   printf("Reading events for thread %u (%s):\n", thread->id, thread->getName());
@@ -248,6 +279,7 @@ static void print_thread(htf::Archive& trace, htf::Thread* thread) {
   auto* reader = new htf::ThreadReader(&trace, thread->id, reader_options);
 
   display_sequence(reader, htf::Token(htf::TypeSequence, 0), nullptr, 0);
+  print_aggregated_calls(&thread, 1);
 }
 
 /**
@@ -311,6 +343,7 @@ void printTrace(htf::Archive& trace) {
     // If you read the doc, you'll know that the memory of tokenOccurence is ours to manage
     std::tie(threadId, tokenOccurence) = getNextToken(readers);
   }
+  print_aggregated_calls(trace.threads, trace.nb_threads);
 }
 
 void usage(const char* prog_name) {
@@ -64,6 +64,8 @@ enum TokenType { TypeInvalid = 0, TypeEvent = 1, TypeSequence = 2, TypeLoop = 3
  * Useful macros
  */
 #define HTF_TOKEN_ID_INVALID 0x3fffffff
+/** Id given to the Events of filtered Regions by htf_register_event_template. Recording it does nothing. */
+#define HTF_TOKEN_ID_FILTERED (HTF_TOKEN_ID_INVALID - 1)
 
 /**
  * Definition of the type for a token ID
@@ -126,6 +128,24 @@ enum EventType {
   HTF_SINGLETON,
 };
 
+/**
+ * Cheaper ways of recording a Thread, that a ThreadWriter switches to when it reaches the limits set by the
+ * maxEvents, maxSequences and maxAttributeBufferSize parameters. Thread::degradations is a combination of them.
+ */
+enum Degradation {
+  HTF_DEGRADATION_FLAT_SEQUENCES = 1 << 0,     /**< The next calls are stored as a flat stream of Events. */
+  HTF_DEGRADATION_PAYLOAD_COLUMNS = 1 << 1,    /**< The fields of the next Events are all volatile fields. */
+  HTF_DEGRADATION_DROPPED_ATTRIBUTES = 1 << 2, /**< Some AttributeLists were dropped. */
+};
+
+/**
+ * Enumeration of the modes of an HTF_EVENT_MEASUREMENT_ON_OFF, the marker of a gap in the recording of a Thread.
+ */
+enum MeasurementMode {
+  HTF_MEASUREMENT_ON = 1,  /**< The recording resumed. */
+  HTF_MEASUREMENT_OFF = 2, /**< The recording was suspended. */
+};
+
 /**
  * Enumeration of the different events that are recorded by HTF
  */
@@ -263,7 +283,7 @@ struct TokenCountMap : public std::map<Token, size_t> {
  */
 typedef struct Sequence {
   LinkedVector* durations CXX({new LinkedVector()}); /**< Vector of durations for these type of sequences. */
-  uint32_t hash CXX({0});                            /**< Hash value according to the hash32 function.*/
+  uint32_t hash CXX({0});                            /**< Hash value according to the hashTokens function.*/
   DEFINE_Vector(Token, tokens);                      /**< Vector of Token to store the sequence of tokens */
   CXX(private:)
   /**
@@ -272,6 +292,9 @@ typedef struct Sequence {
   DEFINE_TokenCountMap(tokenCount);
 #ifdef __cplusplus
  public:
+  Sequence() = default;
+  /** Creates an empty Sequence whose durations are stored in the given LinkedVector. */
+  explicit Sequence(LinkedVector* durations_vector) : durations(durations_vector) {}
   /** Getter for the size of that Sequence.
    * @returns Number of tokens in that Sequence. */
   [[nodiscard]] size_t size() const { return tokens.size(); }
@@ -294,6 +317,19 @@ typedef struct Loop {
   CXX(void addIteration();)           /**< Adds an iteration to the lastest occurence of that loop. */
 } Loop;
 
+/**
+ * Statistics of the calls to a Region that are too short and frequent to be recorded one by one.
+ *
+ * Once a Region is aggregated, its calls that do not record anything else are only counted in the EventSummary of its
+ * Enter: they have no token, and their time is part of the duration of the Event before them.
+ */
+typedef struct AggregatedCalls {
+  size_t nb_calls;                /**< Number of calls that were aggregated. */
+  htf_timestamp_t total_duration; /**< Sum of the durations of those calls. */
+  htf_timestamp_t min_duration;   /**< Duration of the shortest call. */
+  htf_timestamp_t max_duration;   /**< Duration of the longest call. */
+} AggregatedCalls;
+
 /**
  * Summary for an htf::Event.
  *
@@ -302,18 +338,24 @@ typedef struct Loop {
  * and its attributes.
  */
 typedef struct EventSummary {
-  TokenId id;                                        /**< ID of the Event */
-  Event event;                                       /**< The Event being summarized.*/
-  LinkedVector* durations CXX({new LinkedVector()}); /**< Durations for each occurrence of that Event.*/
-  size_t nb_occurences;                              /**< Number of times that Event has happened. */
+  TokenId id;                             /**< ID of the Event */
+  Event event;                            /**< The Event being summarized.*/
+  LinkedVector* durations CXX({nullptr}); /**< Durations for each occurrence of that Event.*/
+  size_t nb_occurences;                   /**< Number of times that Event has happened. */
 
   uint8_t* attribute_buffer;    /**< Storage for Attribute.*/
   size_t attribute_buffer_size; /**< Size of #attribute_buffer.*/
   size_t attribute_pos;         /**< Position of #attribute_buffer.*/
+
+  uint32_t volatile_fields;     /**< Fields of #event that are stored in #volatile_values instead (see VolatileField). */
+  uint64_t* volatile_values;    /**< Values of the #volatile_fields of each occurence, one row after the other. */
+  size_t volatile_values_size;  /**< Number of values allocated in #volatile_values. */
+
+  AggregatedCalls* aggregated_calls CXX({nullptr}); /**< Aggregated calls of the Region of this Enter, or nullptr. */
 #ifdef __cplusplus
  public:
-  /** Initialize and EventSummary */
-  void initEventSummary(TokenId, const Event&);
+  /** Initialize and EventSummary, whose fields selected by `volatile_fields_mask` are stored per occurence. */
+  void initEventSummary(TokenId, const Event&, uint32_t volatile_fields_mask);
 #endif
 } EventSummary;
 
@@ -393,16 +435,39 @@ typedef struct Thread {
   EventSummary* events;         /**< Array of events recorded in this Thread. */
   unsigned nb_allocated_events; /**< Size of #events. */
   unsigned nb_events;           /**< Number of htf::EventSummary in #events. */
+  TokenId* event_index;         /**< Open-addressing hash table of the ids in #events, keyed by the Event bytes. */
+  unsigned event_index_size;    /**< Number of slots in #event_index (a power of two). */
 
   Sequence** sequences;            /**< Array of htf::Sequence recorded in this Thread. */
   unsigned nb_allocated_sequences; /**< Size of #sequences. */
   unsigned nb_sequences;           /**< Number of htf::Sequence in #sequences. */
+  TokenId* sequence_index;         /**< Open-addressing hash table of the ids in #sequences, keyed by hash and size. */
+  unsigned sequence_index_size;    /**< Number of slots in #sequence_index (a power of two). */
 
   Loop* loops;                 /**< Array of htf::Loop recorded in this Thread. */
   unsigned nb_allocated_loops; /**< Size of #loops. */
   unsigned nb_loops;           /**< Number of htf::Loop in #loops. */
+  TokenId* loop_index;         /**< Id of the Loop that repeats each Sequence, indexed by sequence id. */
+  unsigned loop_index_size;    /**< Number of entries in #loop_index. */
+
+  size_t* max_loop_lengths;     /**< Maximum loop length chosen at each level of the callstack by the adaptive
+                                 * loop length, or nullptr if it is disabled. */
+  unsigned nb_max_loop_lengths; /**< Number of levels in #max_loop_lengths. */
+
+  uint32_t degradations;        /**< Cheaper recording modes the Thread switched to, a combination of Degradation. */
+  size_t nb_dropped_attributes; /**< Number of AttributeLists dropped with HTF_DEGRADATION_DROPPED_ATTRIBUTES. */
+  size_t nb_late_events;        /**< Number of Events that arrived after the reorder window, and whose timestamp was
+                                 * moved forward to keep the Events in order. */
+
+  C_CXX(void, Arena) * arena; /**< Arena of the ThreadWriter, in which the Sequences and durations are allocated.
+                               * nullptr when the Thread is read. */
 #ifdef __cplusplus
-  TokenId getEventId(Event* e);
+  /** Search for the id of an Event whose `volatile_fields` were removed, using #event_index.
+   * If that Event was never recorded, register a new EventSummary. */
+  TokenId getEventId(Event* e, uint32_t volatile_fields);
+  /** Search for the id of an Event whose `volatile_fields` were removed, using #event_index.
+   * Returns HTF_TOKEN_ID_INVALID if it was never recorded. Unlike getEventId, this never modifies the Thread. */
+  [[nodiscard]] TokenId findEventId(const Event* e, uint32_t volatile_fields) const;
   [[nodiscard]] Event* getEvent(Token) const;
   [[nodiscard]] EventSummary* getEventSummary(Token) const;
   [[nodiscard]] Sequence* getSequence(Token) const;
@@ -427,19 +492,30 @@ typedef struct Thread {
   [[nodiscard]] const char* getName() const;
   /** Search for a sequence_id that matches the given sequence.
    * If none of the registered sequence match, register a new Sequence.
-   * \todo Speed this up using hash map and/or storing the sequence's id in the structure.
    */
   Token getSequenceId(Sequence* sequence);
   /** Search for a sequence_id that matches the given array as a Sequence.
    * If none of the registered sequence match, register a new Sequence.
-   * \todo Speed this up using hashmap
+   * The lookup goes through #sequence_index, so it does not depend on the number of registered sequences.
    */
   Token getSequenceIdFromArray(Token* token_array, size_t array_len);
+  /** Same as getSequenceIdFromArray(Token*, size_t), when the hashTokens value of the array is already known. */
+  Token getSequenceIdFromArray(Token* token_array, size_t array_len, uint32_t hash);
   /** Returns the duration for the given array. */
   htf_timestamp_t getSequenceDuration(Token* array, size_t size);
   void finalizeThread();
-  /** Create a new Thread from an archive and an id. This is used when writing the trace. */
-  void initThread(Archive* a, ThreadId id);
+  /** Create a new Thread from an archive and an id. This is used when writing the trace.
+   * The Sequences and their durations are then allocated in the given Arena.
+   * If `keep_arrays` is set, the arrays left by clearThread() are reused instead of being allocated. */
+  void initThread(Archive* a, ThreadId id, Arena* arena, bool keep_arrays = false);
+  /** Frees the Events, Sequences and Loops of the Thread, once it has been written. */
+  void releaseThread();
+  /** Empties the Thread once it has been written, like releaseThread(), but keeps its arrays and their capacity. */
+  void clearThread();
+  /** Allocates an empty LinkedVector for the durations of an Event or a Sequence. */
+  LinkedVector* newDurations();
+  /** Allocates an empty Sequence. */
+  Sequence* newSequence();
 
   //  /** Create a blank new Thread. This is used when reading the trace. */
   Thread();
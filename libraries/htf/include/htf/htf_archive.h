@@ -16,6 +16,15 @@
 namespace htf {
 #endif
 
+/** Magic number at the beginning of a `main.htf` file ("HTFT"). Older traces do not have it. */
+#define HTF_FORMAT_MAGIC 0x54465448u
+/**
+ * Version of the trace format, written after #HTF_FORMAT_MAGIC.
+ * - 0: traces without a magic number: no clock, no volatile values, no aggregated calls, sequences hashed with hash32.
+ * - 1: all of the above, plus the loop lengths, degradations and late events of each thread.
+ */
+#define HTF_FORMAT_VERSION 1u
+
 /**
  * A LocationGroup can be a process, a machine, etc.
  */
@@ -86,6 +95,8 @@ typedef struct Archive {
   DEFINE_Vector(LocationGroup, location_groups); /**< Vector of LocationGroup. */
 
   short store_timestamps; /**< Indicates whether there are timestamps in there.*/
+  htf_clock_info_t clock; /**< Clock that produced the timestamps. They are converted to nanoseconds when read. */
+  uint32_t format_version; /**< Version of the trace format the Archive was read from, see #HTF_FORMAT_VERSION. */
 #ifdef __cplusplus
   [[nodiscard]] Thread* getThread(ThreadId) const;
   [[nodiscard]] const struct String* getString(StringRef) const;
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/** @file
+ * A region allocator for the structures that a ThreadWriter creates while recording.
+ *
+ * Those structures (Sequences, LinkedVectors, CallstackFrames, attribute buffers...) are many, small,
+ * and all of them live until the Thread is closed. An Arena carves them out of a few large chunks,
+ * which avoids a call to malloc for each of them, and frees them all at once.
+ */
+#pragma once
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace htf {
+
+/**
+ * Allocates memory by bumping a pointer in large chunks, and releases everything in one go.
+ *
+ * Memory is never given back to the Arena before release(). Objects created with create() are destroyed by release()
+ * in the reverse order of their creation. An Arena is meant to be used by a single thread.
+ */
+class Arena {
+  /** Header of a chunk of memory. The memory handed out follows it. */
+  struct Chunk {
+    Chunk* previous; /**< Chunk that was allocated before this one. */
+    size_t size;     /**< Number of bytes after the header. */
+  };
+  /** Destructor to call on an object when the Arena is released. */
+  struct Finalizer {
+    void (*destroy)(void*);
+    void* object;
+  };
+
+  Chunk* last_chunk{nullptr};        /**< Chunk in which memory is currently handed out. */
+  uint8_t* cursor{nullptr};          /**< First free byte of #last_chunk. */
+  uint8_t* limit{nullptr};           /**< End of #last_chunk. */
+  size_t next_chunk_size;            /**< Size of the next chunk. It doubles up to a maximum. */
+  size_t allocated{0};               /**< Number of bytes of all the chunks. */
+  std::vector<Finalizer> finalizers; /**< Objects to destroy on release(). */
+
+  /** Allocates `size` bytes aligned on `alignment` from a new chunk. This is the slow path of allocate(). */
+  void* allocateFromNewChunk(size_t size, size_t alignment);
+
+ public:
+  /** Creates an empty Arena. No memory is allocated until the first allocation. */
+  Arena();
+  ~Arena() { release(); }
+  Arena(const Arena&) = delete;
+  void operator=(const Arena&) = delete;
+
+  /** Returns `size` uninitialized bytes aligned on `alignment`. */
+  void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+    auto p = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    if (cursor == nullptr || p + size > reinterpret_cast<uintptr_t>(limit))
+      return allocateFromNewChunk(size, alignment);
+    cursor = reinterpret_cast<uint8_t*>(p + size);
+    return reinterpret_cast<void*>(p);
+  }
+
+  /** Returns an uninitialized array of `n` elements of T. */
+  template <class T>
+  T* allocateArray(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>, "Arrays of the Arena are never destroyed");
+    return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+  }
+
+  /** Returns a copy of the `old_n` first elements of `array` in a new array of `new_n` elements.
+   * The other elements are zeroed. The old array is only reclaimed when the Arena is released. */
+  template <class T>
+  T* growArray(T* array, size_t old_n, size_t new_n) {
+    static_assert(std::is_trivially_copyable_v<T>, "Arrays of the Arena are moved bytewise");
+    T* new_array = allocateArray<T>(new_n);
+    if (old_n)
+      memcpy(new_array, array, old_n * sizeof(T));
+    memset(new_array + old_n, 0, (new_n - old_n) * sizeof(T));
+    return new_array;
+  }
+
+  /** Constructs a T in the Arena. Its destructor is called when the Arena is released. */
+  template <class T, class... Args>
+  T* create(Args&&... args) {
+    T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>)
+      finalizers.push_back({[](void* o) { static_cast<T*>(o)->~T(); }, object});
+    return object;
+  }
+
+  /** Number of bytes that the Arena took from the system. */
+  [[nodiscard]] size_t allocatedSize() const { return allocated; }
+
+  /** Destroys all the objects created in the Arena, and frees all of its memory. The Arena can then be reused. */
+  void release();
+  /** Destroys all the objects created in the Arena, but keeps its current chunk to hand out memory from it again.
+   * This is cheaper than release() when the Arena is about to be filled as much as before. */
+  void reset();
+};
+
+}  // namespace htf
+#endif
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/** @file
+ * Asynchronous recording: the application threads only push the Events they record in a ring,
+ * and background threads (the encoders) store them in their ThreadWriter.
+ *
+ * This moves the search for Sequences and Loops out of the measured threads. A ThreadWriter and its
+ * ring are only ever encoded by one thread at a time, which is guaranteed by EventRing::encode_lock.
+ */
+#pragma once
+#ifdef __cplusplus
+#include <atomic>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "htf.h"
+#include "htf_attribute.h"
+#include "htf_record.h"
+
+namespace htf {
+struct ThreadWriter;
+
+/** An Event recorded by an application thread, waiting to be stored by an encoder. */
+struct AsyncEvent {
+  htf_timestamp_t ts;                          /**< Timestamp of the Event. Never HTF_TIMESTAMP_INVALID. */
+  AttributeList* attribute_list;               /**< Copy of the AttributeList, owned by the ring. Or nullptr. */
+  size_t attributes_end;                       /**< Position in EventRing::attributes after #attribute_list. */
+  TokenId event_id;                            /**< Id of the Event in the Thread. */
+  enum EventType event_type;                   /**< How the Event changes the callstack. */
+  bool has_volatile_values;                    /**< Whether #volatile_values was filled. */
+  uint64_t volatile_values[maxVolatileValues]; /**< Values of the volatile fields of the Event. */
+};
+
+/**
+ * Lock-free ring of AsyncEvents between one application thread (the producer) and the encoders.
+ *
+ * Only one thread pushes in a ring. Several threads may pop from it (the encoder, and the producer itself when the
+ * ring is full or being closed), but only while holding #encode_lock.
+ *
+ * The head and tail are written by the consumers and by the producer respectively. The AttributeLists of the
+ * AsyncEvents are copied in #attributes, which is consumed in the same order as #slots: pushing an Event never
+ * allocates memory. Positions in #attributes only grow, and are taken modulo its size.
+ */
+class EventRing {
+  std::vector<AsyncEvent> slots;           /**< Storage of the ring. Its size is a power of two. */
+  size_t mask;                             /**< slots.size() - 1. */
+  std::vector<char> attributes;            /**< Storage of the AttributeLists of the AsyncEvents. */
+  alignas(64) std::atomic<size_t> head{0}; /**< Index of the next AsyncEvent to pop. */
+  std::atomic<size_t> attributes_head{0};  /**< First used byte of #attributes. */
+  alignas(64) std::atomic<size_t> tail{0}; /**< Index of the next AsyncEvent to push. */
+  size_t attributes_tail{0};               /**< First free byte of #attributes. */
+  size_t cached_head{0};                   /**< Last value of #head read by the producer. */
+  size_t cached_attributes_head{0};        /**< Last value of #attributes_head read by the producer. */
+
+  /** Reserves `size` contiguous bytes in #attributes for the producer, and returns their position, or SIZE_MAX if
+   * there is not enough room. An AttributeList is never split: the end of #attributes is skipped if it is too small. */
+  size_t reserveAttributes(size_t size) {
+    size_t capacity = attributes.size();
+    size_t pos = attributes_tail;
+    size_t offset = pos % capacity;
+    if (offset + size > capacity)
+      pos += capacity - offset;
+    if (pos + size - cached_attributes_head > capacity) {
+      cached_attributes_head = attributes_head.load(std::memory_order_acquire);
+      if (pos + size - cached_attributes_head > capacity)
+        return SIZE_MAX;
+    }
+    return pos;
+  }
+
+ public:
+  /** Serializes the consumers of the ring, and everything that touches the ThreadWriter while it is encoded. */
+  std::mutex encode_lock;
+  /** Encoder that drains this ring. */
+  class AsyncEncoder* encoder{nullptr};
+  /** Number of times the producer found the ring full and had to encode the Events itself. */
+  size_t nb_stalls{0};
+
+  /** Creates a ring of at least `size` AsyncEvents. */
+  explicit EventRing(size_t size);
+
+  /** Pushes an AsyncEvent, along with a copy of `attribute_list` if it is not nullptr. Returns false if the ring is
+   * full. Only called by the producer. */
+  bool tryPush(const AsyncEvent& event, const AttributeList* attribute_list) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cached_head > mask) {
+      cached_head = head.load(std::memory_order_acquire);
+      if (t - cached_head > mask)
+        return false;
+    }
+    AsyncEvent& slot = slots[t & mask];
+    slot = event;
+    slot.attribute_list = nullptr;
+    if (attribute_list) {
+      size_t pos = reserveAttributes(attribute_list->struct_size);
+      if (pos == SIZE_MAX)
+        return false;
+      slot.attribute_list = reinterpret_cast<AttributeList*>(&attributes[pos % attributes.size()]);
+      memcpy(slot.attribute_list, attribute_list, attribute_list->struct_size);
+      attributes_tail = pos + attribute_list->struct_size;
+    }
+    slot.attributes_end = attributes_tail;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Pops all the AsyncEvents that were pushed so far, and gives them to `f` in order. Their AttributeLists are only
+   * valid until `f` returns. Must be called with #encode_lock held. Returns the number of AsyncEvents popped. */
+  template <class F>
+  size_t drain(F&& f) {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+    if (h == t)
+      return 0;
+    for (size_t i = h; i < t; i++)
+      f(slots[i & mask]);
+    attributes_head.store(slots[(t - 1) & mask].attributes_end, std::memory_order_release);
+    head.store(t, std::memory_order_release);
+    return t - h;
+  }
+};
+
+/**
+ * Background thread that stores the AsyncEvents of the rings of several ThreadWriters.
+ *
+ * The encoders are started when the first asynchronous ThreadWriter is opened, and stopped when the last one is
+ * closed. Each ThreadWriter is given to one of them in a round-robin fashion.
+ */
+class AsyncEncoder {
+  std::mutex lock;                    /**< Protects #writers and #stop. */
+  std::condition_variable wake_up;    /**< Signaled to stop the encoder. */
+  std::vector<ThreadWriter*> writers; /**< ThreadWriters whose ring is drained by this encoder. */
+  bool stop{false};                   /**< Whether the encoder should exit. */
+  std::thread thread;                 /**< The background thread. */
+
+  /** Main loop of the background thread. */
+  void run();
+
+ public:
+  AsyncEncoder();
+  /** Stops the background thread. The encoder must not have any ThreadWriter left. */
+  ~AsyncEncoder();
+
+  /** Gives a ThreadWriter to an encoder, starting the encoders if needed. */
+  static void attach(ThreadWriter* writer);
+  /** Takes a ThreadWriter back from its encoder, stopping the encoders if it was the last one.
+   * Once this returns, the encoder does not touch the ThreadWriter anymore. */
+  static void detach(ThreadWriter* writer);
+};
+
+}  // namespace htf
+#endif
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/** @file
+ * Out-of-process recording: the application (the client) only appends raw messages to shared-memory rings,
+ * and a separate process, htf_collector, replays them in ThreadWriters and writes the trace.
+ *
+ * The client creates a control ring, named after the collector parameter, for the definitions and the archives.
+ * Each ThreadWriter then gets a ring of its own for its Events. Since the rings live in shared memory,
+ * the collector can still write everything that was recorded when the application crashes.
+ */
+#pragma once
+#ifdef __cplusplus
+#include <sys/types.h>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "htf.h"
+#include "htf_attribute.h"
+#include "htf_timestamp.h"
+
+namespace htf {
+
+/** Kinds of messages sent from the client to the collector. */
+enum class CollectorMessageType : uint32_t {
+  Padding,           /**< Fills the end of a ring when a message does not fit there. */
+  ArchiveOpen,       /**< An Archive was opened. Followed by its directory and trace names. */
+  ArchiveClose,      /**< An Archive was closed: the collector can write it. */
+  String,            /**< A String was registered. Followed by the string. */
+  Region,            /**< A Region was registered. */
+  Attribute,         /**< An Attribute was registered. */
+  LocationGroup,     /**< A LocationGroup was defined. */
+  Location,          /**< A Location was defined. */
+  ThreadOpen,        /**< A ThreadWriter was opened, with a ring of its own. */
+  ThreadClose,       /**< Last message of the ring of a ThreadWriter. */
+  Event,             /**< An Event was recorded. Followed by the Event and its AttributeList. */
+  EventTemplate,     /**< An Event was registered with htf_register_event_template. Followed by the Event. */
+  EventById,         /**< An Event registered with htf_register_event_template was recorded. */
+  MeasurementOnOff,  /**< The recording was suspended or resumed. */
+  Clock,             /**< The client read its first timestamp: the clock that measures them. */
+};
+
+/** Header of every message. */
+struct CollectorMessage {
+  CollectorMessageType type; /**< Kind of the message. */
+  uint32_t size;             /**< Size of the message in bytes, with this header and what follows the message. */
+};
+
+/** Payload of CollectorMessageType::ArchiveOpen. */
+struct ArchiveOpenMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::ArchiveOpen;
+  CollectorMessage header;
+  uint64_t archive;       /**< Key of the Archive, used by the other messages to refer to it. */
+  LocationGroupId id;     /**< Id of the Archive. */
+  uint32_t dir_name_size; /**< Size of the directory name, with its '\0'. The trace name follows it. */
+};
+/** Payload of CollectorMessageType::ArchiveClose. */
+struct ArchiveCloseMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::ArchiveClose;
+  CollectorMessage header;
+  uint64_t archive; /**< Key of the Archive. */
+};
+/** Payload of CollectorMessageType::Clock. */
+struct ClockMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::Clock;
+  CollectorMessage header;
+  htf_clock_info_t clock; /**< Clock that measures the timestamps of the client. */
+};
+/** Payload of CollectorMessageType::String. */
+struct StringMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::String;
+  CollectorMessage header;
+  uint64_t archive;     /**< Key of the Archive. */
+  StringRef string_ref; /**< Id of the String. */
+};
+/** Payload of CollectorMessageType::Region. */
+struct RegionMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::Region;
+  CollectorMessage header;
+  uint64_t archive;     /**< Key of the Archive. */
+  RegionRef region_ref; /**< Id of the Region. */
+  StringRef string_ref; /**< Name of the Region. */
+};
+/** Payload of CollectorMessageType::Attribute. */
+struct AttributeMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::Attribute;
+  CollectorMessage header;
+  uint64_t archive;           /**< Key of the Archive. */
+  AttributeRef attribute_ref; /**< Id of the Attribute. */
+  StringRef name;             /**< Name of the Attribute. */
+  StringRef description;      /**< Description of the Attribute. */
+  htf_type_t attribute_type;  /**< Type of the Attribute. */
+};
+/** Payload of CollectorMessageType::LocationGroup and CollectorMessageType::Location. */
+template <CollectorMessageType T>
+struct LocationMessage {
+  static constexpr CollectorMessageType type = T;
+  CollectorMessage header;
+  uint64_t archive;       /**< Key of the Archive. */
+  uint32_t id;            /**< Id of the LocationGroup or of the Location. */
+  StringRef name;         /**< Name of the LocationGroup or of the Location. */
+  LocationGroupId parent; /**< Parent LocationGroup. */
+};
+/** Payload of CollectorMessageType::ThreadOpen. */
+struct ThreadOpenMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::ThreadOpen;
+  CollectorMessage header;
+  uint64_t archive;    /**< Key of the Archive of the Thread. */
+  ThreadId thread_id;  /**< Id of the Thread. */
+  uint32_t ring_index; /**< Index of the ring of the ThreadWriter. */
+};
+/** Payload of CollectorMessageType::ThreadClose. */
+struct ThreadCloseMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::ThreadClose;
+  CollectorMessage header;
+};
+/** Payload of CollectorMessageType::Event. */
+struct EventMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::Event;
+  CollectorMessage header;
+  htf_timestamp_t ts;       /**< Timestamp of the Event. */
+  uint8_t event_type;      /**< How the Event changes the callstack, an EventType. */
+  uint16_t attribute_size; /**< Size of the AttributeList that follows the Event, or 0. */
+};
+/** Payload of CollectorMessageType::EventTemplate. */
+struct EventTemplateMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::EventTemplate;
+  CollectorMessage header;
+  TokenId template_id; /**< Id returned to the application by htf_register_event_template. */
+};
+/** Payload of CollectorMessageType::EventById. */
+struct EventByIdMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::EventById;
+  CollectorMessage header;
+  htf_timestamp_t ts;      /**< Timestamp of the Event. */
+  TokenId template_id;     /**< Id returned to the application by htf_register_event_template. */
+  uint8_t event_type;      /**< How the Event changes the callstack, an EventType. */
+  uint16_t attribute_size; /**< Size of the AttributeList that follows the message, or 0. */
+};
+
+/** Payload of CollectorMessageType::MeasurementOnOff. */
+struct MeasurementOnOffMessage {
+  static constexpr CollectorMessageType type = CollectorMessageType::MeasurementOnOff;
+  CollectorMessage header;
+  htf_timestamp_t ts; /**< Timestamp of the marker. */
+  int32_t nb_closed;  /**< Number of calls open before the gap that the skipped Events closed. */
+  int32_t nb_opened;  /**< Number of calls that the skipped Events opened and left open. */
+  uint8_t mode;       /**< A MeasurementMode. */
+};
+
+/**
+ * Ring of messages in shared memory, between one client thread (the producer) and the collector.
+ * The data of the ring follows this header in the shared memory.
+ */
+struct SharedRing {
+  std::atomic<uint64_t> magic;            /**< Set to #magic_value once the ring is initialized. */
+  uint64_t size;                          /**< Number of bytes of data. A power of two. */
+  pid_t producer;                         /**< Process that writes in the ring. */
+  alignas(64) std::atomic<uint64_t> head; /**< Offset of the next message to read. Written by the collector. */
+  alignas(64) std::atomic<uint64_t> tail; /**< Offset of the next message to write. Written by the producer. */
+
+  /** Value of #magic of an initialized ring. */
+  static constexpr uint64_t magic_value = 0x4854465f52494e47;  // "HTF_RING"
+
+  /** Returns the data of the ring. */
+  uint8_t* data() { return reinterpret_cast<uint8_t*>(this + 1); }
+
+  /** Returns the size in a ring of a message made of `M` followed by `data_size` bytes. */
+  template <class M>
+  static constexpr size_t messageSize(size_t data_size) {
+    return (sizeof(M) + data_size + 7) & ~(size_t)7;
+  }
+
+  /** Appends a message made of `m` followed by two buffers. Returns false if the ring is full.
+   * The message must not be larger than #size. Only called by the producer. */
+  template <class M>
+  bool tryPush(M& m, const void* data1 = nullptr, size_t size1 = 0, const void* data2 = nullptr, size_t size2 = 0) {
+    size_t message_size = messageSize<M>(size1 + size2);
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    uint64_t h = head.load(std::memory_order_acquire);
+    size_t offset = t & (size - 1);
+    // Messages are never split: if it does not fit before the end of the ring, it starts over at the beginning.
+    if (offset + message_size > size) {
+      size_t padding = size - offset;
+      if (t + padding - h > size)
+        return false;
+      auto* p = reinterpret_cast<CollectorMessage*>(&data()[offset]);
+      p->type = CollectorMessageType::Padding;
+      p->size = padding;
+      t += padding;
+      offset = 0;
+      // The padding is published alone: once the collector skipped it, the message can use the whole ring.
+      tail.store(t, std::memory_order_release);
+    }
+    if (t + message_size - h > size)
+      return false;
+    m.header.type = M::type;
+    m.header.size = message_size;
+    uint8_t* dest = &data()[offset];
+    memcpy(dest, &m, sizeof(M));
+    if (size1)
+      memcpy(dest + sizeof(M), data1, size1);
+    if (size2)
+      memcpy(dest + sizeof(M) + size1, data2, size2);
+    tail.store(t + message_size, std::memory_order_release);
+    return true;
+  }
+
+  /** Gives all the messages written so far to `f`, in order. Returns the number of messages.
+   * Only called by the collector. */
+  template <class F>
+  size_t drain(F&& f) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    uint64_t t = tail.load(std::memory_order_acquire);
+    size_t nb_messages = 0;
+    while (h < t) {
+      auto* m = reinterpret_cast<const CollectorMessage*>(&data()[h & (size - 1)]);
+      if (m->type != CollectorMessageType::Padding) {
+        f(m);
+        nb_messages++;
+      }
+      h += m->size;
+    }
+    head.store(h, std::memory_order_release);
+    return nb_messages;
+  }
+};
+
+/** Returns the name of the shared memory of a ring. Index 0 is the control ring, the others are ThreadWriters. */
+std::string sharedRingName(const char* collector_name, uint32_t index);
+/** Creates a ring of `size` bytes of data in the shared memory called `name`. */
+SharedRing* createSharedRing(const std::string& name, size_t size);
+/** Maps the existing ring in the shared memory called `name`. Returns nullptr if it does not exist (yet). */
+SharedRing* openSharedRing(const std::string& name);
+/** Unmaps a ring. It stays in the shared memory until it is removed with shm_unlink. */
+void closeSharedRing(SharedRing* ring);
+
+class CollectorClient;
+
+/** Writing state of a ThreadWriter in client mode. */
+struct CollectorThread {
+  CollectorClient* client;                /**< Client of the process. */
+  SharedRing* ring;                       /**< Ring in which the Events of the ThreadWriter are sent. */
+  std::vector<enum EventType> templates; /**< Events registered with htf_register_event_template, by id. */
+};
+
+/**
+ * Client side of the collector: sends what the application records to the rings.
+ * The client mode is enabled by the collector parameter.
+ */
+class CollectorClient {
+  std::string name;                    /**< Name of the collector. */
+  SharedRing* control;                 /**< Ring of the definitions and archives. */
+  std::mutex control_lock;             /**< Serializes the threads that write in #control. */
+  std::atomic<uint32_t> next_ring{1};  /**< Index of the next ring given to a ThreadWriter. */
+  std::atomic<bool> clock_sent{false}; /**< Whether the clock of the client was sent to the collector. */
+
+  explicit CollectorClient(const char* collector_name);
+
+ public:
+  /** Returns the client of this process, or nullptr if the client mode is not enabled. */
+  static CollectorClient* get();
+  /** Disables the client mode in this process. This is what the collector itself does. */
+  static void disable();
+
+  /** Sends a message on the control ring. Returns false if the message was dropped, see sendTo. */
+  template <class M>
+  bool send(M& m, const void* data1 = nullptr, size_t size1 = 0, const void* data2 = nullptr, size_t size2 = 0) {
+    std::lock_guard<std::mutex> guard(control_lock);
+    return sendTo(control, m, data1, size1, data2, size2);
+  }
+
+  /** Sends a message on a ring, waiting for the collector if the ring is full.
+   * A message larger than the whole ring would never fit: it is dropped, and false is returned. */
+  template <class M>
+  static bool sendTo(SharedRing* ring,
+                     M& m,
+                     const void* data1 = nullptr,
+                     size_t size1 = 0,
+                     const void* data2 = nullptr,
+                     size_t size2 = 0) {
+    size_t message_size = SharedRing::messageSize<M>(size1 + size2);
+    if (message_size > ring->size) {
+      htf_warn("A message of %zu bytes is larger than the ring (%zu bytes): it is dropped\n", message_size,
+               (size_t)ring->size);
+      return false;
+    }
+    size_t nb_tries = 0;
+    while (!ring->tryPush(m, data1, size1, data2, size2))
+      waitForCollector(nb_tries++);
+    return true;
+  }
+  /** Reads a timestamp if `ts` is invalid, like htf_timestamp. The first time, the clock is sent to the collector:
+   * it is known before the Archives are closed, even if the application crashes. */
+  htf_timestamp_t timestamp(htf_timestamp_t ts) {
+    if (ts != HTF_TIMESTAMP_INVALID)
+      return ts;
+    ts = htf_get_timestamp();
+    if (!clock_sent.load(std::memory_order_relaxed) && !clock_sent.exchange(true))
+      sendClock();
+    return ts;
+  }
+  /** Sends the clock of the client on the control ring. */
+  void sendClock();
+  /** Backs off while a ring is full. Warns once if the collector does not seem to be running. */
+  static void waitForCollector(size_t nb_tries);
+
+  /** Creates the ring of `ring_size` bytes of a new ThreadWriter, and tells the collector about it. */
+  CollectorThread* openThread(uint64_t archive, ThreadId thread_id, size_t ring_size);
+  /** Sends the last message of a ThreadWriter, and unmaps its ring. */
+  static void closeThread(CollectorThread* thread);
+};
+
+}  // namespace htf
+#endif
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/** @file
+ * Record-time filtering of the Regions selected by the includeRegions and excludeRegions parameters.
+ *
+ * The globs are only matched when a Region is registered: recording an Event then costs a single lookup
+ * in a bitmap over the RegionRefs.
+ */
+#pragma once
+#ifdef __cplusplus
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "htf.h"
+
+namespace htf {
+
+/**
+ * Set of the Regions whose Events are not recorded.
+ *
+ * RegionRefs are shared by all the Archives of a process, so are the names of the Regions. The bitmap is only
+ * written when a Region is registered: it is then copied, so that the recording threads can read it without
+ * any lock.
+ */
+class RegionFilter {
+  /** Current bitmap: bit r is set if RegionRef r is filtered. Or nullptr if no Region is filtered. */
+  std::atomic<const std::vector<uint64_t>*> bitmap{nullptr};
+  /** Protects everything below. */
+  std::mutex lock;
+  /** Previous versions of #bitmap. They are never freed, since a recording thread may still be reading them. */
+  std::vector<const std::vector<uint64_t>*> old_bitmaps;
+  /** Registered Strings, by StringRef. Only filled when a filter is set. */
+  std::unordered_map<StringRef, std::string> strings;
+  /** Regions whose name was not registered yet, by StringRef of their name. */
+  std::unordered_multimap<StringRef, RegionRef> unnamed_regions;
+
+  /** Adds a Region to #bitmap. Called with #lock held. */
+  void filter(RegionRef region_ref);
+
+ public:
+  /** Returns whether the Events of a Region are not recorded. */
+  [[nodiscard]] bool isFiltered(RegionRef region_ref) const {
+    const std::vector<uint64_t>* b = bitmap.load(std::memory_order_acquire);
+    return b && region_ref / 64 < b->size() && ((*b)[region_ref / 64] >> (region_ref % 64)) & 1;
+  }
+  /** Keeps the name of a String, in case a Region refers to it. */
+  void addString(StringRef string_ref, const char* string);
+  /** Matches the name of a new Region against the filters. */
+  void addRegion(RegionRef region_ref, StringRef name_ref);
+};
+
+/** The RegionFilter of this process. */
+extern RegionFilter regionFilter;
+
+}  // namespace htf
+#endif
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
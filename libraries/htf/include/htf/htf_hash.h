@@ -3,7 +3,7 @@
  * See LICENSE in top-level directory.
  */
 /** @file
- * Hashing functions, used for hashing htf::Sequence.
+ * Hashing functions, used for hashing htf::Sequence and htf::Event.
  */
 #pragma once
 
@@ -15,8 +15,52 @@
 namespace htf {
 /** Writes a 32bits hash value to out.*/
 void hash32(const void* key, size_t len, uint32_t seed, uint32_t* out);
+/** Writes a 32bits hash value of the first `size` bytes of key to out.*/
+void hash32Bytes(const void* key, size_t size, uint32_t seed, uint32_t* out);
 /** Writes a 64bits hash value to out.*/
 void hash64(const void* key, size_t len, uint32_t seed, uint64_t* out);
+
+/** Multiplier of the polynomial hash used for arrays of tokens. */
+#define HTF_TOKEN_HASH_BASE 0x9e3779b97f4a7c15ull
+
+/*
+ * Polynomial hash of arrays of tokens: hash(t0 ... tn) = hash(t0 ... tn-1) * HTF_TOKEN_HASH_BASE + hashToken(tn).
+ *
+ * Unlike hash32, it can be updated one token at a time, and the hash of any sub-array can be
+ * computed from the hashes of the prefixes of an array (see htf::hashRange).
+ */
+/** Returns the value a Token adds to a polynomial hash. */
+inline uint64_t hashToken(Token t) {
+  uint64_t k = (((uint64_t)t.id << 2) | t.type) + SEED;
+  k *= 0xbf58476d1ce4e5b9ull;
+  return k ^ (k >> 31);
+}
+/** Returns the polynomial hash of an array after appending t to it. */
+inline uint64_t hashAppend(uint64_t hash, Token t) {
+  return hash * HTF_TOKEN_HASH_BASE + hashToken(t);
+}
+/** Returns HTF_TOKEN_HASH_BASE to the power of len. */
+inline uint64_t hashPower(size_t len) {
+  uint64_t result = 1;
+  uint64_t base = HTF_TOKEN_HASH_BASE;
+  for (; len; len >>= 1) {
+    if (len & 1)
+      result *= base;
+    base *= base;
+  }
+  return result;
+}
+/** Returns the polynomial hash of the sub-array [start, end[ of length len,
+ * given the polynomial hashes of [0, start[ and [0, end[. */
+inline uint64_t hashRange(uint64_t prefix_start, uint64_t prefix_end, size_t len) {
+  return prefix_end - prefix_start * hashPower(len);
+}
+/** Folds a polynomial hash to the 32bits stored in htf::Sequence::hash. */
+inline uint32_t hashFold(uint64_t hash) {
+  return (uint32_t)(hash >> 32) ^ (uint32_t)hash;
+}
+/** Returns the polynomial hash of an array of tokens, folded to 32bits. */
+uint32_t hashTokens(const Token* tokens, size_t len);
 }  // namespace htf
 #endif
 
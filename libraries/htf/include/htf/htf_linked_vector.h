@@ -17,8 +17,9 @@
 #include <iostream>
 #include <memory>
 #include <vector>
-/** Default size for creating Vectors and SubVectors.*/
-#define DEFAULT_VECTOR_SIZE 1000
+#include "htf_arena.h"
+/** Size of the first SubVector of a LinkedVector. Each following SubVector is twice as large as the previous one. */
+#define DEFAULT_VECTOR_SIZE 16
 namespace htf {
 #endif
 /**
@@ -98,10 +99,15 @@ typedef struct LinkedVector {
      * Construct a SubVector from a given already allocated array, and its size.
      * @param size Size of `array`.
      * @param array Allocated array of values.
+     * @param previous_subvector Previous SubVector in the LinkedVector.
      */
-    SubVector(size_t size, uint64_t* array) {
-      previous = nullptr;
+    SubVector(size_t size, uint64_t* array, SubVector* previous_subvector = nullptr) {
+      previous = previous_subvector;
       starting_index = 0;
+      if (previous) {
+        previous->next = this;
+        starting_index = previous->starting_index + previous->size;
+      }
       allocated = size;
       this->array = array;
     }
@@ -113,15 +119,20 @@ typedef struct LinkedVector {
     void copyToArray(uint64_t* given_array) const { memcpy(given_array, array, size * sizeof(uint64_t)); }
   };
 #endif
-  size_t defaultSize CXX({DEFAULT_VECTOR_SIZE}); /**< Default size of the newly created SubVectors.*/
-  C_CXX(void, SubVector) * first;                /**< First SubVector in the LinkedList structure.*/
-  C_CXX(void, SubVector) * last;                 /**< Last SubVector in the LinkedList structure.*/
+  size_t defaultSize CXX({DEFAULT_VECTOR_SIZE}); /**< Size of the first SubVector.*/
+  C_CXX(void, SubVector) * first;                /**< First SubVector in the LinkedList structure. nullptr if empty.*/
+  C_CXX(void, SubVector) * last;                 /**< Last SubVector in the LinkedList structure. nullptr if empty.*/
+  C_CXX(void, Arena) * arena CXX({nullptr});     /**< Arena in which the SubVectors are allocated, if any. */
 #ifdef __cplusplus
  public:
   /**
-   * Creates a new LinkedVector, with a SubVector of size `defaultSize`.
+   * Creates a new, empty LinkedVector.
+   * No memory is allocated until the first element is added: the first SubVector holds `defaultSize` elements,
+   * and each following SubVector is twice as large as the previous one.
    */
   LinkedVector();
+  /** Creates a new, empty LinkedVector whose SubVectors are allocated in the given Arena. */
+  explicit LinkedVector(Arena* arena);
   /** Loads a LinkedVector from a file without reading the size. */
   LinkedVector(FILE* file, size_t size);
   /** Loads a LinkedVector from a file. */
@@ -174,6 +185,12 @@ typedef struct LinkedVector {
    */
   void writeToFile(FILE* file, bool writeSize) const;
 
+ private:
+  /** Allocates a SubVector that holds `size` elements, after the given one. */
+  SubVector* newSubVector(size_t size, SubVector* previous);
+
+ public:
+
   /**
    * Classic ForwardIterator for LinkedVector.
    */
@@ -8,7 +8,9 @@
  */
 #pragma once
 #include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 #ifdef WITH_SZ
 #undef SZ
@@ -104,7 +106,12 @@ enum class LoopFindingAlgorithm {
   /** Start by filtering the tokens and only running the loop finding algorithm on the interesting ones.
    * See ThreadWriter::findLoopFilter for more information.
    */
-  Filter
+  Filter,
+  /** Same candidates as BasicTruncated, but each candidate is checked by comparing prefix hashes of the
+   * current sequence, so that ParameterHandler::maxLoopLength can be much larger.
+   * See ThreadWriter::findLoopRollingHash for more information.
+   */
+  RollingHash
 };
 
 /**
@@ -122,11 +129,82 @@ inline std::string algorithmToString(LoopFindingAlgorithm alg) {
     return "BasicTruncated";
   case LoopFindingAlgorithm::Filter:
     return "Filter";
+  case LoopFindingAlgorithm::RollingHash:
+    return "RollingHash";
   default:
     return "Non Defined Loop-Finding Algorithm";
   }
 }
 
+/** A set of clocks that htf_get_timestamp can read. */
+enum class ClockSource {
+  /** The timestamps are given by the user when recording the events. They are assumed to be in nanoseconds.
+   * This cannot be selected, it is only used to describe a trace. */
+  User = 0,
+  /** CLOCK_MONOTONIC. */
+  Monotonic = 1,
+  /** CLOCK_MONOTONIC_RAW, which is not subject to NTP adjustments. */
+  MonotonicRaw = 2,
+  /** CLOCK_MONOTONIC_COARSE: cheaper to read, but only as precise as the scheduler tick. */
+  MonotonicCoarse = 3,
+  /** The invariant TSC of x86 CPUs, read with rdtsc. Its frequency is calibrated at startup. */
+  TSC = 4
+};
+
+/**
+ * Converts a clock source to its string name.
+ * @param clock Clock source.
+ * @return String such that it shall be parsed to that clock's enum.
+ */
+inline std::string algorithmToString(ClockSource clock) {
+  switch (clock) {
+  case ClockSource::User:
+    return "User";
+  case ClockSource::Monotonic:
+    return "Monotonic";
+  case ClockSource::MonotonicRaw:
+    return "MonotonicRaw";
+  case ClockSource::MonotonicCoarse:
+    return "MonotonicCoarse";
+  case ClockSource::TSC:
+    return "TSC";
+  default:
+    return "Non Defined Clock Source";
+  }
+}
+
+/** Fields of the MPI payloads that change at almost every call.
+ * Values are bit flags: ParameterHandler::volatileFields is a combination of them. */
+enum class VolatileField : uint32_t {
+  /** No field is volatile: every field is part of the Event. */
+  None = 0,
+  /** The request of a non-blocking call. */
+  RequestID = 1 << 0,
+  /** The length of a message. */
+  MessageLength = 1 << 1,
+  /** The tag of a message. */
+  MessageTag = 1 << 2,
+};
+
+/**
+ * Converts a set of volatile fields to the string that lists them.
+ * @param fields Combination of VolatileField values.
+ * @return Comma-separated names, such that it shall be parsed to that set of fields.
+ */
+inline std::string volatileFieldsToString(uint32_t fields) {
+  if (fields == 0)
+    return "None";
+  std::string result;
+  if (fields & (uint32_t)VolatileField::RequestID)
+    result += "RequestID,";
+  if (fields & (uint32_t)VolatileField::MessageLength)
+    result += "MessageLength,";
+  if (fields & (uint32_t)VolatileField::MessageTag)
+    result += "MessageTag,";
+  result.pop_back();
+  return result;
+}
+
 /**
  * A simple data class that contains information on different parameters.
  */
@@ -139,13 +217,58 @@ class ParameterHandler {
   EncodingAlgorithm encodingAlgorithm{EncodingAlgorithm::None};
   /** The compression algorithm used during the execution. */
   LoopFindingAlgorithm loopFindingAlgorithm{LoopFindingAlgorithm::BasicTruncated};
-  /** The max length the LoopFindingAlgorithm::BasicTruncated will go to.*/
+  /** The max length the LoopFindingAlgorithm::BasicTruncated and LoopFindingAlgorithm::RollingHash will go to.*/
   size_t maxLoopLength{100};
+  /** Whether each ThreadWriter adapts #maxLoopLength at each level of the callstack, starting from #maxLoopLength,
+   * to the length of the Loops it finds there. */
+  bool adaptiveLoopLength{false};
+  /** The clock read by htf_get_timestamp. */
+  ClockSource clockSource{ClockSource::Monotonic};
+  /** The VolatileField that are removed from the Events, and stored for each occurence instead. */
+  uint32_t volatileFields{(uint32_t)VolatileField::None};
+  /** Whether a single iteration of a Loop is recorded as that Loop, so that the Sequences around Loops
+   * only differ by the number of iterations. */
+  bool parametricLoops{false};
+  /** Whether the Events are pushed in a ring by the application threads, and stored by background threads. */
+  bool asyncRecording{false};
+  /** Number of Events that the ring of each ThreadWriter holds when #asyncRecording is enabled. */
+  size_t asyncRingSize{65536};
+  /** Number of background threads that store the Events when #asyncRecording is enabled. */
+  size_t asyncEncoders{1};
+  /** Name of the htf_collector process that writes the trace. If it is empty, the application writes it. */
+  std::string collector;
+  /** Number of bytes of the shared-memory ring of each ThreadWriter when a #collector is used. */
+  size_t collectorRingSize{4 << 20};
+  /** Globs of the names of the Regions that are recorded. If it is empty, all the Regions are recorded. */
+  std::vector<std::string> includeRegions;
+  /** Globs of the names of the Regions that are not recorded, even if they match #includeRegions. */
+  std::vector<std::string> excludeRegions;
+  /** Minimum number of calls per second to a Region for its calls to be aggregated. If it is 0, no call is. */
+  uint64_t aggregationMinRate{0};
+  /** Maximum mean duration in nanoseconds of the calls to a Region for them to be aggregated. */
+  uint64_t aggregationMaxDuration{100};
+  /** Number of distinct Events of a Thread after which all its fields are volatile fields. 0 means no limit. */
+  uint64_t maxEvents{0};
+  /** Number of Sequences of a Thread after which its calls are stored as a flat stream of Events. 0 means no limit. */
+  uint64_t maxSequences{0};
+  /** Number of bytes of AttributeLists of an Event after which its next ones are dropped. 0 means no limit. */
+  uint64_t maxAttributeBufferSize{0};
+  /** Whether the ThreadWriterPool keeps the ThreadWriters it is given back open, so that the next threads record
+   * on the same logical Locations. */
+  bool poolLogicalLocations{false};
+  /** Time during which an Event waits in the reorder buffer of its ThreadWriter for the Events that are older than
+   * it but arrive later, in the unit of the timestamps. 0 means no time window. */
+  uint64_t reorderWindow{0};
+  /** Number of Events that the reorder buffer of a ThreadWriter holds at most. 0 means no size window. */
+  uint64_t reorderBufferSize{0};
 
  public:
   /** Getter for #maxLoopLength. Error if you're not supposed to have a maximum loop length.
    * @returns Value of #maxLoopLength. */
   [[nodiscard]] size_t getMaxLoopLength() const;
+  /** Getter for #adaptiveLoopLength.
+   * @returns Value of #adaptiveLoopLength, or false if the loop finding algorithm has no maximum loop length. */
+  [[nodiscard]] bool getAdaptiveLoopLength() const;
   /** Getter for #zstdCompressionLevel. Error if you're not using ZSTD.
    * @returns Value of #zstdCompressionLevel. */
   [[nodiscard]] u_int8_t getZstdCompressionLevel() const;
@@ -161,6 +284,95 @@ class ParameterHandler {
    * @returns Value of #loopFindingAlgorithm.
    */
   [[nodiscard]] LoopFindingAlgorithm getLoopFindingAlgorithm() const;
+  /**
+   * Getter for #clockSource.
+   * @returns Value of #clockSource.
+   */
+  [[nodiscard]] ClockSource getClockSource() const;
+  /**
+   * Getter for #volatileFields.
+   * @returns Value of #volatileFields, a combination of VolatileField.
+   */
+  [[nodiscard]] uint32_t getVolatileFields() const;
+  /**
+   * Getter for #parametricLoops.
+   * @returns Value of #parametricLoops.
+   */
+  [[nodiscard]] bool getParametricLoops() const;
+  /**
+   * Getter for #asyncRecording.
+   * @returns Value of #asyncRecording.
+   */
+  [[nodiscard]] bool getAsyncRecording() const;
+  /**
+   * Getter for #asyncRingSize.
+   * @returns Value of #asyncRingSize.
+   */
+  [[nodiscard]] size_t getAsyncRingSize() const;
+  /**
+   * Getter for #asyncEncoders.
+   * @returns Value of #asyncEncoders, at least 1.
+   */
+  [[nodiscard]] size_t getAsyncEncoders() const;
+  /**
+   * Getter for #collector.
+   * @returns Value of #collector, or nullptr if no collector is used.
+   */
+  [[nodiscard]] const char* getCollector() const;
+  /**
+   * Getter for #collectorRingSize.
+   * @returns Value of #collectorRingSize.
+   */
+  [[nodiscard]] size_t getCollectorRingSize() const;
+  /**
+   * Whether some Regions may not be recorded, ie. #includeRegions or #excludeRegions is set.
+   */
+  [[nodiscard]] bool hasRegionFilter() const;
+  /**
+   * Matches the name of a Region against #includeRegions and #excludeRegions.
+   * @returns Whether the Events of that Region are recorded.
+   */
+  [[nodiscard]] bool isRegionRecorded(const char* name) const;
+  /**
+   * Getter for #aggregationMinRate.
+   * @returns Value of #aggregationMinRate, or 0 if the calls are never aggregated.
+   */
+  [[nodiscard]] uint64_t getAggregationMinRate() const;
+  /**
+   * Getter for #aggregationMaxDuration.
+   * @returns Value of #aggregationMaxDuration.
+   */
+  [[nodiscard]] uint64_t getAggregationMaxDuration() const;
+  /**
+   * Getter for #maxEvents.
+   * @returns Value of #maxEvents, or 0 if there is no limit.
+   */
+  [[nodiscard]] uint64_t getMaxEvents() const;
+  /**
+   * Getter for #maxSequences.
+   * @returns Value of #maxSequences, or 0 if there is no limit.
+   */
+  [[nodiscard]] uint64_t getMaxSequences() const;
+  /**
+   * Getter for #maxAttributeBufferSize.
+   * @returns Value of #maxAttributeBufferSize, or 0 if there is no limit.
+   */
+  [[nodiscard]] uint64_t getMaxAttributeBufferSize() const;
+  /**
+   * Getter for #poolLogicalLocations.
+   * @returns Value of #poolLogicalLocations.
+   */
+  [[nodiscard]] bool getPoolLogicalLocations() const;
+  /**
+   * Getter for #reorderWindow.
+   * @returns Value of #reorderWindow, or 0 if there is no time window.
+   */
+  [[nodiscard]] uint64_t getReorderWindow() const;
+  /**
+   * Getter for #reorderBufferSize.
+   * @returns Value of #reorderBufferSize, or 0 if there is no size window.
+   */
+  [[nodiscard]] uint64_t getReorderBufferSize() const;
   /** Creates a ParameterHandler from a config file loaded from CONFIG_FILE_PATH or config.json.
    */
   ParameterHandler();
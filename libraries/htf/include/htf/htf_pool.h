@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/** @file
+ * Recycling of the ThreadWriters of short-lived threads, such as the workers of a task pool.
+ *
+ * Opening a ThreadWriter allocates its buffers, and closing it stores its Thread: doing both for each thread would
+ * slow down the creation of the threads. The pool keeps the buffers of the closed ThreadWriters for the next threads,
+ * and stores the Threads from a background thread.
+ */
+#pragma once
+#ifdef __cplusplus
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "htf.h"
+
+namespace htf {
+struct ThreadWriter;
+
+/**
+ * Pool of ThreadWriters, see htf_thread_writer_acquire and htf_thread_writer_release.
+ *
+ * The ThreadWriters that are given back are closed by a background thread (the closer), which is started when the
+ * first one is given back. With the poolLogicalLocations parameter, they are kept open instead, so that the next
+ * threads of the same Archive record on their Location: they are only closed with their Archive.
+ */
+class ThreadWriterPool {
+  /** A ThreadWriter that was given back, and the Archive of its Thread. */
+  struct Entry {
+    ThreadWriter* writer; /**< The ThreadWriter. */
+    Archive* archive;     /**< Archive in which its Thread was opened. */
+  };
+
+  std::mutex lock;                                  /**< Protects everything below. */
+  std::condition_variable wake_up;                  /**< Signaled when #to_close or #closing change, or to stop. */
+  std::unordered_map<ThreadWriter*, Archive*> used; /**< Archive of each ThreadWriter that was acquired. */
+  std::vector<ThreadWriter*> free_writers;          /**< Closed ThreadWriters, whose buffers are kept. */
+  std::vector<Entry> open_writers;                  /**< Open ThreadWriters given back, with poolLogicalLocations. */
+  std::deque<Entry> to_close;                       /**< ThreadWriters given back, waiting for the closer. */
+  Entry closing{nullptr, nullptr};                  /**< ThreadWriter being closed by the closer. */
+  bool stop{false};                                 /**< Whether the closer should exit once #to_close is empty. */
+  std::thread closer;                               /**< The background thread. */
+
+  /** Main loop of the closer. */
+  void run();
+  /** Returns whether a ThreadWriter of the Archive is waiting for the closer, or being closed. Called with #lock held. */
+  [[nodiscard]] bool isClosing(const Archive* archive) const;
+
+ public:
+  ThreadWriterPool() = default;
+  /** Stops the closer once it closed the ThreadWriters given to it, and frees the ThreadWriters of the pool. */
+  ~ThreadWriterPool();
+
+  /** Returns an open ThreadWriter, see htf_thread_writer_acquire. */
+  ThreadWriter* acquire(Archive* archive,
+                        ThreadId thread_id,
+                        Archive* global_archive,
+                        StringRef name,
+                        LocationGroupId parent);
+  /** Gives a ThreadWriter back, see htf_thread_writer_release. */
+  void release(ThreadWriter* writer);
+  /** Closes the ThreadWriters of the pool that are still open in the Archive, and waits until their Threads are
+   * stored. This is called when the Archive is closed. */
+  void closeArchive(Archive* archive);
+};
+
+/** The ThreadWriterPool of this process. */
+extern ThreadWriterPool threadWriterPool;
+
+}  // namespace htf
+#endif
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -32,6 +32,7 @@ typedef struct EventOccurence {
   htf_timestamp_t timestamp; /**< Timestamp for that occurence.*/
   htf_timestamp_t duration;  /**< Duration of that occurence.*/
   AttributeList* attributes; /**< Attributes for that occurence.*/
+  uint64_t* volatile_values; /**< Values of the EventSummary::volatile_fields for that occurence, or nullptr.*/
 } EventOccurence;
 
 /**
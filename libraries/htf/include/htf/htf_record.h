@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/** @file
+ * Typed schemas of the payloads of the Events.
+ *
+ * Each Record has a packed struct that describes its payload, ie. the content of Event::event_data.
+ * encodeEvent and decodeEvent copy that struct in and out of an Event in one go.
+ * To record a new kind of Event, define its schema here and call htf_record with it.
+ *
+ * Some fields of the payloads change at almost every call (see VolatileField). When they are selected in the
+ * configuration, they are removed from the Event and stored for each occurence, so that the identity of an Event
+ * only depends on its stable fields.
+ */
+#pragma once
+#ifdef __cplusplus
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "htf.h"
+#include "htf_parameter_handler.h"
+
+namespace htf {
+
+/** Payload of an HTF_EVENT_ENTER. */
+struct EnterRecord {
+  static constexpr enum Record record = HTF_EVENT_ENTER;
+  static constexpr enum EventType event_type = HTF_BLOCK_START;
+  RegionRef region_ref;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_LEAVE. */
+struct LeaveRecord {
+  static constexpr enum Record record = HTF_EVENT_LEAVE;
+  static constexpr enum EventType event_type = HTF_BLOCK_END;
+  RegionRef region_ref;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_THREAD_BEGIN. */
+struct ThreadBeginRecord {
+  static constexpr enum Record record = HTF_EVENT_THREAD_BEGIN;
+  static constexpr enum EventType event_type = HTF_BLOCK_START;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_THREAD_END. */
+struct ThreadEndRecord {
+  static constexpr enum Record record = HTF_EVENT_THREAD_END;
+  static constexpr enum EventType event_type = HTF_BLOCK_END;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_THREAD_TEAM_BEGIN. */
+struct ThreadTeamBeginRecord {
+  static constexpr enum Record record = HTF_EVENT_THREAD_TEAM_BEGIN;
+  static constexpr enum EventType event_type = HTF_BLOCK_START;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_THREAD_TEAM_END. */
+struct ThreadTeamEndRecord {
+  static constexpr enum Record record = HTF_EVENT_THREAD_TEAM_END;
+  static constexpr enum EventType event_type = HTF_BLOCK_END;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MEASUREMENT_ON_OFF. */
+struct MeasurementOnOffRecord {
+  static constexpr enum Record record = HTF_EVENT_MEASUREMENT_ON_OFF;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint8_t measurementMode;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_SEND. */
+struct MpiSendRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_SEND;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint32_t receiver;
+  uint32_t communicator;
+  uint32_t msgTag;
+  uint64_t msgLength;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_ISEND. */
+struct MpiIsendRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_ISEND;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint32_t receiver;
+  uint32_t communicator;
+  uint32_t msgTag;
+  uint64_t msgLength;
+  uint64_t requestID;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_ISEND_COMPLETE. */
+struct MpiIsendCompleteRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_ISEND_COMPLETE;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint64_t requestID;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_IRECV_REQUEST. */
+struct MpiIrecvRequestRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_IRECV_REQUEST;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint64_t requestID;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_RECV. */
+struct MpiRecvRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_RECV;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint32_t sender;
+  uint32_t communicator;
+  uint32_t msgTag;
+  uint64_t msgLength;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_IRECV. */
+struct MpiIrecvRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_IRECV;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint32_t sender;
+  uint32_t communicator;
+  uint32_t msgTag;
+  uint64_t msgLength;
+  uint64_t requestID;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_COLLECTIVE_BEGIN. */
+struct MpiCollectiveBeginRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_COLLECTIVE_BEGIN;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+} __attribute__((packed));
+
+/** Payload of an HTF_EVENT_MPI_COLLECTIVE_END. */
+struct MpiCollectiveEndRecord {
+  static constexpr enum Record record = HTF_EVENT_MPI_COLLECTIVE_END;
+  static constexpr enum EventType event_type = HTF_SINGLETON;
+  uint32_t collectiveOp;
+  uint32_t communicator;
+  uint32_t root;
+  uint64_t sizeSent;
+  uint64_t sizeReceived;
+} __attribute__((packed));
+
+/** Position of a VolatileField in the payload of a Record. */
+struct VolatileFieldLayout {
+  enum Record record;  /**< Record whose payload contains the field. */
+  VolatileField field; /**< Kind of field. */
+  size_t offset;       /**< Offset of the field in Event::event_data. */
+  size_t size;         /**< Size of the field, in bytes. */
+};
+
+/** Describes the field `member` of the schema R as a VolatileField of kind `kind`. */
+#define HTF_VOLATILE_FIELD(R, member, kind) \
+  { R::record, VolatileField::kind, offsetof(R, member), sizeof(R::member) }
+
+/** The VolatileFields of every schema, grouped by Record. */
+inline constexpr VolatileFieldLayout volatileFieldLayouts[] = {
+  HTF_VOLATILE_FIELD(MpiSendRecord, msgTag, MessageTag),
+  HTF_VOLATILE_FIELD(MpiSendRecord, msgLength, MessageLength),
+  HTF_VOLATILE_FIELD(MpiIsendRecord, msgTag, MessageTag),
+  HTF_VOLATILE_FIELD(MpiIsendRecord, msgLength, MessageLength),
+  HTF_VOLATILE_FIELD(MpiIsendRecord, requestID, RequestID),
+  HTF_VOLATILE_FIELD(MpiIsendCompleteRecord, requestID, RequestID),
+  HTF_VOLATILE_FIELD(MpiIrecvRequestRecord, requestID, RequestID),
+  HTF_VOLATILE_FIELD(MpiRecvRecord, msgTag, MessageTag),
+  HTF_VOLATILE_FIELD(MpiRecvRecord, msgLength, MessageLength),
+  HTF_VOLATILE_FIELD(MpiIrecvRecord, msgTag, MessageTag),
+  HTF_VOLATILE_FIELD(MpiIrecvRecord, msgLength, MessageLength),
+  HTF_VOLATILE_FIELD(MpiIrecvRecord, requestID, RequestID),
+};
+
+/** Maximum number of VolatileFields in a payload. */
+constexpr size_t maxVolatileValues = 3;
+/** Combination of all the VolatileFields. */
+constexpr uint32_t allVolatileFields =
+  (uint32_t)VolatileField::RequestID | (uint32_t)VolatileField::MessageLength | (uint32_t)VolatileField::MessageTag;
+
+/** Returns the combination of the VolatileFields that the payload of a Record contains. */
+inline uint32_t volatileFieldsOf(enum Record record) {
+  uint32_t fields = 0;
+  for (const auto& layout : volatileFieldLayouts)
+    if (layout.record == record)
+      fields |= (uint32_t)layout.field;
+  return fields;
+}
+
+/** Returns the number of values that an occurence of an Event of the given Record stores for the given fields. */
+inline size_t countVolatileValues(enum Record record, uint32_t fields) {
+  size_t n = 0;
+  for (const auto& layout : volatileFieldLayouts)
+    if (layout.record == record && (fields & (uint32_t)layout.field))
+      n++;
+  return n;
+}
+
+/** Moves the given fields out of the payload of the Event: their values are copied to `values`,
+ * in the order of volatileFieldLayouts, and they are zeroed in the Event.
+ * @returns Number of values copied, at most maxVolatileValues. */
+inline size_t extractVolatileFields(Event* e, uint32_t fields, uint64_t* values) {
+  size_t n = 0;
+  for (const auto& layout : volatileFieldLayouts) {
+    if (layout.record == e->record && (fields & (uint32_t)layout.field)) {
+      values[n] = 0;
+      memcpy(&values[n++], &e->event_data[layout.offset], layout.size);
+      memset(&e->event_data[layout.offset], 0, layout.size);
+    }
+  }
+  return n;
+}
+
+/** Puts back the values of the given fields, as returned by extractVolatileFields, in the payload of the Event. */
+inline void restoreVolatileFields(Event* e, uint32_t fields, const uint64_t* values) {
+  size_t n = 0;
+  for (const auto& layout : volatileFieldLayouts)
+    if (layout.record == e->record && (fields & (uint32_t)layout.field))
+      memcpy(&e->event_data[layout.offset], &values[n++], layout.size);
+}
+
+/** Number of bytes that the schema R takes in Event::event_data. Schemas without fields take none. */
+template <class R>
+constexpr size_t payloadSize() {
+  return std::is_empty_v<R> ? 0 : sizeof(R);
+}
+
+/** Fills the Event with the record of R and the given payload.
+ * Only the bytes up to Event::event_size are written. */
+template <class R>
+inline void encodeEvent(Event* e, const R& payload) {
+  static_assert(std::is_trivially_copyable_v<R>, "Record schemas are copied bytewise");
+  static_assert(payloadSize<R>() < sizeof(e->event_data), "Record schema does not fit in an Event");
+  e->record = R::record;
+  e->event_size = offsetof(Event, event_data) + payloadSize<R>();
+  if constexpr (payloadSize<R>() > 0)
+    memcpy(e->event_data, &payload, sizeof(R));
+}
+
+/** Returns the payload of an Event whose record is R::record. */
+template <class R>
+inline R decodeEvent(const Event* e) {
+  R payload;
+  if constexpr (payloadSize<R>() > 0)
+    memcpy(&payload, e->event_data, sizeof(R));
+  return payload;
+}
+
+/** Decodes the payload of all the Events of the Thread whose record is R::record, along with their id.
+ * The VolatileFields that are stored per occurence are left to 0. */
+template <class R>
+std::vector<std::pair<TokenId, R>> decodeEvents(const Thread* thread) {
+  std::vector<std::pair<TokenId, R>> result;
+  for (TokenId i = 0; i < thread->nb_events; i++) {
+    const Event* e = &thread->events[i].event;
+    if (e->record == R::record)
+      result.emplace_back(i, decodeEvent<R>(e));
+  }
+  return result;
+}
+
+}  // namespace htf
+#endif
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
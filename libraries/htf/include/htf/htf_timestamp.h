@@ -20,23 +20,67 @@ extern "C" {
 typedef uint64_t htf_timestamp_t;
 #define HTF_TIMESTAMP_INVALID UINT64_MAX
 
-/** return the current timestamp */
+/** Describes the clock that produced the timestamps of a trace, so that they can be converted to nanoseconds. */
+typedef struct htf_clock_info {
+  uint32_t source;    /**< htf::ClockSource that produced the timestamps. */
+  double resolution;  /**< Resolution of the clock, in nanoseconds. */
+  double ns_per_tick; /**< Number of nanoseconds in one tick of the clock. */
+} htf_clock_info_t;
+
+/** return the current timestamp, in ticks of the clock selected by the ParameterHandler */
 htf_timestamp_t htf_get_timestamp();
 
 /** return t, or the current timestamp if t is invalid*/
 htf_timestamp_t htf_timestamp(htf_timestamp_t t);
 
-/** Writes the difference between the given timestamp and the last timestamp to the adress of the last timestamp,
- * and then stores the given adress. */
-void htf_delta_timestamp(htf_timestamp_t* t);
+/** Returns the description of the clock used by htf_get_timestamp.
+ * If it was never called, all the timestamps were given by the user: they are then assumed to be in nanoseconds. */
+htf_clock_info_t htf_get_clock_info();
 
-void htf_add_timestamp_to_delta(htf_timestamp_t* t);
+/** Makes htf_get_clock_info return the given clock.
+ * This is used by htf_collector, whose timestamps were measured by the application. */
+void htf_set_clock_info(const htf_clock_info_t* clock);
 
-/** Writes 0 to the last timestamp */
-void htf_finish_timestamp();
+/** Converts a timestamp or a duration measured by the given clock to nanoseconds. */
+htf_timestamp_t htf_clock_to_ns(const htf_clock_info_t* clock, htf_timestamp_t ticks);
 
 #ifdef __cplusplus
 };
+
+#include <vector>
+namespace htf {
+/**
+ * Timestamps of the Events recorded by one ThreadWriter, from which all the durations are computed when it closes.
+ *
+ * Recording an Event only appends its timestamp to a contiguous buffer. The duration slot of the Event holds its
+ * rank in that buffer, and the duration slots of Sequences and Loops hold their start timestamp. They are all
+ * replaced with durations by resolve(), once the deltas between consecutive Events are computed in bulk.
+ */
+struct TimestampBuffer {
+  /** Timestamps of the Events, in the order they were recorded. */
+  std::vector<htf_timestamp_t> timestamps;
+  /** A duration slot that holds a start timestamp, and that ends with the Event recorded after `last_event`. */
+  struct PendingDuration {
+    htf_timestamp_t* slot;
+    size_t last_event;
+  };
+  /** Duration slots of Sequences and Loops, waiting for resolve(). */
+  std::vector<PendingDuration> pending;
+
+  /** Records the timestamp of an Event and returns its rank, which is to be stored in its duration slot. */
+  size_t add(htf_timestamp_t ts) {
+    timestamps.push_back(ts);
+    return timestamps.size() - 1;
+  }
+  /** Registers a slot that holds a start timestamp, and that ends when the next Event is recorded. */
+  void addPending(htf_timestamp_t* slot) { pending.push_back({slot, timestamps.size() - 1}); }
+  /** Replaces the start timestamps of the pending slots with durations, then turns the buffer into the durations of
+   * the Events: timestamps[i] becomes the time elapsed until the next Event. The duration of the last Event is 0. */
+  void resolve();
+  /** Releases the buffers. */
+  void clear();
+};
+}  // namespace htf
 #endif
 
 /* -*-
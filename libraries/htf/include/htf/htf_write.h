@@ -9,8 +9,120 @@
 #include "htf.h"
 #include "htf_archive.h"
 #include "htf_attribute.h"
+#include "htf_hash.h"
 #ifdef __cplusplus
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "htf_async.h"
 namespace htf {
+class EventRing;
+struct CollectorThread;
+
+/**
+ * Writing state of one level of the callstack, kept alongside the Sequence being written at that level.
+ */
+struct CallstackFrame {
+  /** Running hashes of the Sequence: prefix_hashes[i] is the hashAppend value of its first i tokens.
+   * It always holds one more element than the Sequence. */
+  std::vector<uint64_t> prefix_hashes{0};
+  /** Start timestamp of each token of the Sequence, ie. the timestamp of its first Event.
+   * The start of the Sequence itself is thus token_starts[0]. */
+  std::vector<htf_timestamp_t> token_starts;
+
+  /** Whether #token_positions and #loop_positions are maintained.
+   * They are only used by ThreadWriter::findLoopFilter. */
+  bool index_positions{false};
+  /** Positions of each token in the Sequence, in increasing order. The key is the raw value of the Token. */
+  std::unordered_map<uint32_t, std::vector<size_t>> token_positions;
+  /** Positions of the Loop tokens in the Sequence, in increasing order. */
+  std::vector<size_t> loop_positions;
+
+  /** Maximum length of the Loops searched in the Sequence, with the adaptive loop length. */
+  size_t max_loop_length{0};
+  /** Length of the longest Loop found at this level of the callstack. */
+  size_t longest_loop{0};
+  /** Number of tokens examined by the searches that found no Loop since #max_loop_length last changed. */
+  size_t failed_search_cost{0};
+
+  /** Updates the running hash and the index with a token appended to the Sequence, that started at `start`. */
+  void push(Token t, htf_timestamp_t start);
+  /** Rolls the running hash, the start timestamps and the index back to the first `size` tokens of the Sequence.
+   * This has to be called before the tokens are removed from the Sequence. */
+  void truncate(const std::vector<Token>& tokens, size_t size);
+  /** Returns the key of a Token in #token_positions. */
+  static uint32_t positionKey(Token t) { return ((uint32_t)t.id << 2) | t.type; }
+  /** Returns the polynomial hash of the `len` tokens of the Sequence starting at `start`. */
+  [[nodiscard]] uint64_t hash(size_t start, size_t len) const {
+    return hashRange(prefix_hashes[start], prefix_hashes[start + len], len);
+  }
+};
+
+/**
+ * Writing state of the aggregation of the short and frequent calls, see AggregatedCalls.
+ *
+ * The leaf calls of each Region are observed by windows of #window_size calls: if the calls of a window are frequent
+ * and short enough, the following calls of that Region are aggregated.
+ */
+struct CallAggregator {
+  /** Number of calls in an observation window. */
+  static constexpr uint32_t window_size = 1024;
+  /** Leaf calls of a Region observed during the current window. */
+  struct Window {
+    htf_timestamp_t start;          /**< Start of the first call of the window. */
+    htf_timestamp_t total_duration; /**< Sum of the durations of the calls of the window. */
+    uint32_t nb_calls;              /**< Number of calls of the window. */
+  };
+  /** Current window of each Region, indexed by the TokenId of its Enter. */
+  std::vector<Window> windows;
+  /** Enter of an aggregated Region whose Leave was not recorded yet, or HTF_TOKEN_ID_INVALID. */
+  TokenId pending_enter{HTF_TOKEN_ID_INVALID};
+  /** Timestamp of #pending_enter. */
+  htf_timestamp_t pending_start{0};
+};
+
+/**
+ * Reorder buffer of the Events of a ThreadWriter, for the sources that deliver some of their Events late.
+ *
+ * The Events are kept sorted by timestamp, and are only stored once they leave the window set by the reorderWindow
+ * and reorderBufferSize parameters. An Event that is not older than the previous one is simply appended, and once
+ * the buffer has reached its size, buffering an Event does not allocate memory.
+ */
+struct ReorderBuffer {
+  /** Events waiting to be stored from #first on, sorted by timestamp. The Events with the same timestamp keep their
+   * order. The Events before #first were stored: they are removed once they are half of the vector. */
+  std::vector<AsyncEvent> events;
+  /** Index of the oldest Event waiting to be stored. */
+  size_t first{0};
+  /** Copies of AttributeLists of the Events that left the buffer, kept for the next Events. */
+  std::vector<AttributeList*> free_attribute_lists;
+  /** Largest timestamp received so far. */
+  htf_timestamp_t newest{0};
+  /** Timestamp of the last Event that left the buffer. The Events older than that arrived too late. */
+  htf_timestamp_t last_stored{0};
+
+  /** Returns a copy of the AttributeList, that is given back with releaseAttributeList. */
+  AttributeList* copyAttributeList(const AttributeList* attribute_list) {
+    AttributeList* copy;
+    if (free_attribute_lists.empty()) {
+      copy = static_cast<AttributeList*>(malloc(sizeof(AttributeList)));
+    } else {
+      copy = free_attribute_lists.back();
+      free_attribute_lists.pop_back();
+    }
+    memcpy(copy, attribute_list, attribute_list->struct_size);
+    return copy;
+  }
+  /** Gives back a copy made by copyAttributeList. */
+  void releaseAttributeList(AttributeList* attribute_list) {
+    if (attribute_list)
+      free_attribute_lists.push_back(attribute_list);
+  }
+  ~ReorderBuffer() {
+    for (auto* l : free_attribute_lists)
+      free(l);
+  }
+};
 #endif
 /**
  * Writes one thread to the HTF trace format.
@@ -18,15 +130,49 @@ namespace htf {
 typedef struct ThreadWriter {
   Thread thread_trace; /**< Thread being written. */
   Sequence** og_seq;   /**< Array of pointers to sequences. todo: Complete this. */
+  C_CXX(void, CallstackFrame) * *frames; /**< Writing state of each level of the callstack, parallel to #og_seq. */
+  C_CXX(void, TimestampBuffer) * timestamps; /**< Timestamps of the recorded Events, turned into durations on close. */
+  C_CXX(void, Arena) * arena; /**< Allocator of the Sequences, durations, CallstackFrames and attribute buffers.
+                               * Everything it holds is freed at once when the Thread is closed. */
+  C_CXX(void, std::vector<size_t>) * loop_lengths; /**< Sorted lengths of the Sequences repeated by the Loops.
+                                                    * nullptr unless the parametric loops are enabled. */
+  C_CXX(void, EventRing) * ring; /**< Ring in which the Events are pushed before being stored.
+                                  * nullptr unless the asynchronous recording is enabled. */
+  C_CXX(void, CollectorThread) * collector; /**< Shared-memory ring in which the Events are sent to htf_collector.
+                                             * nullptr unless a collector is used. */
+  C_CXX(void, CallAggregator) * aggregator; /**< Aggregation of the short and frequent calls.
+                                             * nullptr unless the aggregationMinRate parameter is set. */
+  C_CXX(void, ReorderBuffer) * reorder; /**< Events waiting to be sorted by timestamp. nullptr unless the
+                                         * reorderWindow or reorderBufferSize parameter is set. */
   int cur_depth;       /**< Current depth in the callstack. */
   int max_depth;       /**< Maximum depth in the callstack. */
   int thread_rank;     /**< Rank of this thread. todo: MPI rank ? */
+  uint32_t volatile_fields; /**< VolatileFields removed from the Events: the volatileFields parameter, or all of them
+                             * once the Thread has more distinct Events than the maxEvents parameter. */
+  int flat_depth;           /**< Number of calls opened since the Sequences were flattened, that are still open. */
+  int measurement_off;      /**< Whether the recording is suspended (see htf_measurement_off).
+                             * Only accessed with relaxed atomic operations. */
+  int skipped_depth;        /**< Number of calls opened minus the number of calls closed by the Events that were
+                             * skipped since the recording was suspended. */
+  int skipped_min_depth;    /**< Lowest value of #skipped_depth since the recording was suspended: the opposite
+                             * of the number of calls, open before the gap, that were closed during it. */
+  int recycled;             /**< Whether the ThreadWriter belongs to a ThreadWriterPool: its buffers are then kept
+                             * when its Thread is closed, and reused by reopen(). */
 #ifdef __cplusplus
  private:
+  /** Opens the Thread, reusing the buffers of the previous one if #recycled is set.
+   * The ring of the asynchronous recording or of the collector is `nb_streams` times smaller than for a thread. */
+  void openThread(Archive* archive, ThreadId thread_id, unsigned nb_streams);
   void findLoopBasic(size_t maxLoopLength);
   void findLoopFilter();
+  void findLoopRollingHash(size_t maxLoopLength);
   /** Tries to find a Loop in the current array of tokens.  */
   void findLoop();
+  /** Returns the maximum length of the Loops searched in the current Sequence. */
+  [[nodiscard]] size_t getMaxLoopLength() const;
+  /** Grows or shrinks the maximum loop length of the current level after a search, with the adaptive loop length.
+   * @param searched_size Size of the current Sequence when the search started. */
+  void adaptMaxLoopLength(size_t searched_size);
   /** Creates a Loop in the trace, and returns a pointer to it.
    * Does not change the current array of tokens.
    * @param start_index Starting index of the loop (first token in the loop).
@@ -42,27 +188,154 @@ typedef struct ThreadWriter {
    * @param index_second_iteration Starting index of the second iteration of the loop.
    */
   void replaceTokensInLoop(int loop_len, size_t index_first_iteration, size_t index_second_iteration);
+  /** Remove the last tokens of the current Sequence, which are another iteration of the given Loop.
+   *
+   * For example, replaces `[L1, E1, E2, E3, E4]` with `[L1]`, where L1 contains one more iteration.
+   * @param loop Loop whose Token lies just before the iteration.
+   * @param index_iteration Starting index of the iteration in the current Sequence.
+   */
+  void addLoopIteration(Loop* loop, size_t index_iteration);
+  /** Replace the last tokens of the current Sequence, which are one iteration of the given Loop, with that Loop.
+   *
+   * For example, replaces `[E1, E2, E3, E4]` with `[L1]`, where L1 contains 1 * S1 = `[E1, E2, E3, E4]`.
+   * @param loop Loop whose repeated Sequence are the last tokens.
+   * @param index_iteration Starting index of the iteration in the current Sequence.
+   */
+  void replaceTokensInSingleIteration(Loop* loop, size_t index_iteration);
+  /** Searches for a Loop whose repeated Sequence are the last tokens of the current Sequence,
+   * and replaces them with an occurence of that Loop. This is only done with the parametric loops.
+   * @returns Whether the tokens were replaced. */
+  bool findSingleIteration();
   /** Returns a pointer to the current Sequence being written. */
   [[nodiscard]] Sequence* getCurrentSequence() const { return og_seq[cur_depth]; };
-  /** Stores the timestamp in the given EventSummary. */
+  /** Returns the writing state of the current Sequence. */
+  [[nodiscard]] CallstackFrame& getCurrentFrame() const { return *frames[cur_depth]; };
+  /** Allocates the Sequence and the CallstackFrame of a level of the callstack that was never reached before. */
+  void createCallstackLevel(int depth);
+  /** Appends a token that started at `start` to the current Sequence, without searching for a Loop. */
+  void pushToken(Token t, htf_timestamp_t start);
+  /** Removes the last tokens of the current Sequence, so that it only keeps the first `size` ones. */
+  void truncateCurrentSequence(size_t size);
+  /** Records the timestamp of an Event, and stores its rank as the duration of that occurence in the EventSummary. */
   void storeTimestamp(EventSummary* es, htf_timestamp_t ts);
+  /** Stores the values of the volatile fields of the last occurence of the given EventSummary.
+   * If `values` is nullptr, the fields are recorded as 0. */
+  void storeVolatileValues(EventSummary* es, const uint64_t* values);
   /** Stores the attribute list in the given EventSummary. */
   void storeAttributeList(EventSummary* es, AttributeList* attribute_list, size_t occurence_index);
-  /** Stores the tokens in that Sequence's array of Tokens, then tries to find a Loop.*/
-  void storeToken(Sequence* seq, Token t);
+  /** Switches the Thread to a cheaper recording mode, and warns about it the first time.
+   * @param degradation HTF_DEGRADATION_FLAT_SEQUENCES or HTF_DEGRADATION_DROPPED_ATTRIBUTES. The payload columns are
+   * enabled by getEventId, in the thread that records the Events. */
+  void degrade(enum Degradation degradation);
+  /** Stores the token in the current Sequence's array of Tokens, then tries to find a Loop.
+   * @param t Token to store.
+   * @param start Timestamp of the first Event of that token. */
+  void storeToken(Token t, htf_timestamp_t start);
   /** Move up the callstack and create a new Sequence. */
   void recordEnterFunction();
   /** Close a Sequence and move down the callstack. */
   void recordExitFunction();
+  /** Stores an occurence of an Event: its timestamp, its token and its attributes. Returns its occurence index. */
+  size_t storeOccurence(enum EventType event_type,
+                        TokenId event_id,
+                        htf_timestamp_t ts,
+                        AttributeList* attribute_list,
+                        const uint64_t* volatile_values);
+  /** Aggregates the Event if it is the Enter or the Leave of a call to an aggregated Region.
+   * @returns Whether the Event was aggregated, in which case it must not be stored. */
+  bool aggregateCall(enum EventType event_type, TokenId event_id, htf_timestamp_t ts, AttributeList* attribute_list);
+  /** Stores the Enter of an aggregated Region that is waiting for its Leave, if there is one. */
+  void storePendingCall();
+  /** Stores an Event whose timestamp is in order: aggregates it, or stores its occurence.
+   * Returns its occurence index, or SIZE_MAX if it was part of an aggregated call. */
+  size_t storeSortedEvent(enum EventType event_type,
+                          TokenId event_id,
+                          htf_timestamp_t ts,
+                          AttributeList* attribute_list,
+                          const uint64_t* volatile_values);
+  /** Puts an Event in #reorder, then stores the Events that left the window. */
+  void reorderEvent(enum EventType event_type,
+                    TokenId event_id,
+                    htf_timestamp_t ts,
+                    AttributeList* attribute_list,
+                    const uint64_t* volatile_values);
+  /** Stores the oldest Event of #reorder. */
+  void storeFirstReorderedEvent();
+  /** Stores all the Events of #reorder, for instance when the Thread is closed. */
+  void flushReorderBuffer();
+  /** Accounts for a call to a Region that did not record anything else, and decides whether to aggregate that Region.
+   * @param enter TokenId of the Enter of the call.
+   * @param start Timestamp of the Enter.
+   * @param end Timestamp of the Leave. */
+  void observeCall(TokenId enter, htf_timestamp_t start, htf_timestamp_t end);
+  /** Closes the current level of the callstack, without storing an Event. */
+  void closeCallstackLevel();
+  /** Stores a MeasurementOnOff marker. When the recording resumes, the `nb_closed` levels of the callstack that were
+   * closed by the skipped Events are closed first, then the `nb_opened` levels that they opened and left open are
+   * opened, so that the next Events are stored at the right level. */
+  void storeMeasurementOnOff(enum MeasurementMode mode, htf_timestamp_t ts, int nb_closed, int nb_opened);
+  /** Pushes an Event in #ring. If the ring is full, stores the Events it holds first. */
+  void pushEvent(enum EventType event_type,
+                 TokenId event_id,
+                 htf_timestamp_t ts,
+                 AttributeList* attribute_list,
+                 const uint64_t* volatile_values);
 
  public:
   void open(Archive* archive, ThreadId thread_id);
+  /** Opens a new Thread in a ThreadWriter whose previous Thread was closed with #recycled set.
+   * The buffers of the previous Thread are reused, with their capacity. */
+  void reopen(Archive* archive, ThreadId thread_id);
+  /** Opens one of the `nb_streams` ThreadWriters recorded by the calling thread, see htf_write_streams_open. */
+  void openStream(Archive* archive, ThreadId thread_id, unsigned nb_streams);
   void threadClose();
-  /** Creates the new Event and stores it. Returns the occurence index of that new Event. */
+  /** Frees the buffers of the ThreadWriter, once its Thread is closed. */
+  void freeBuffers();
+  /** Replaces the ranks and start timestamps in the duration slots of the Thread with the actual durations.
+   * This is done once all the Events have been recorded. */
+  void resolveDurations();
+  /** Creates the new Event and stores it. Returns the occurence index of that new Event, or SIZE_MAX if it was part
+   * of an aggregated call or if it waits in the reorder buffer.
+   * `volatile_values` are the values of the fields that were removed from the Event by extractVolatileFields. */
   size_t storeEvent(enum EventType event_type,
                     TokenId event_id,
                     htf_timestamp_t ts,
-                    struct AttributeList* attribute_list);
+                    struct AttributeList* attribute_list,
+                    const uint64_t* volatile_values = nullptr);
+  /** Records an Event: stores it right away, or pushes it in #ring with the asynchronous recording. */
+  void recordEvent(enum EventType event_type,
+                   TokenId event_id,
+                   htf_timestamp_t ts,
+                   struct AttributeList* attribute_list,
+                   const uint64_t* volatile_values = nullptr);
+  /** Returns the id of an Event, registering it if needed. Unlike Thread::getEventId, this can be called
+   * while the Thread is being written by an encoder. */
+  TokenId getEventId(Event* e);
+  /** Stores the Events waiting in #ring. Returns how many there were. */
+  size_t encodeRing();
+  /** Records an Event that was already encoded, whose volatile fields are still in place. */
+  void recordEncodedEvent(enum EventType event_type, Event* e, htf_timestamp_t ts, AttributeList* attribute_list);
+  /** Sends an Event to the collector, which records it with recordEncodedEvent. */
+  void sendEvent(enum EventType event_type, const Event* e, htf_timestamp_t ts, AttributeList* attribute_list);
+  /** Sends an Event registered with htf_register_event_template to the collector. Returns the id of the template. */
+  TokenId sendEventTemplate(const Event* e);
+  /** Sends an occurence of an Event registered with htf_register_event_template to the collector. */
+  void sendEventById(enum EventType event_type, TokenId template_id, htf_timestamp_t ts, AttributeList* attribute_list);
+  /** Returns whether the recording is suspended. This is a single relaxed atomic load. */
+  [[nodiscard]] bool isMeasurementOff() const { return __atomic_load_n(&measurement_off, __ATOMIC_RELAXED); }
+  /** Accounts for an Event that is not recorded because the recording is suspended. */
+  void skipEvent(enum EventType event_type) {
+    if (event_type == HTF_BLOCK_START) {
+      skipped_depth++;
+    } else if (event_type == HTF_BLOCK_END) {
+      skipped_depth--;
+      skipped_min_depth = std::min(skipped_min_depth, skipped_depth);
+    }
+  }
+  /** Suspends or resumes the recording, and records a MeasurementOnOff marker (see htf_measurement_off). */
+  void setMeasurement(enum MeasurementMode mode, htf_timestamp_t ts);
+  /** Records a MeasurementOnOff marker with storeMeasurementOnOff, once the Events waiting in #ring are stored. */
+  void recordMeasurementOnOff(enum MeasurementMode mode, htf_timestamp_t ts, int nb_closed, int nb_opened);
 
 #endif
 } ThreadWriter;
@@ -103,6 +376,74 @@ extern void htf_store_event(HTF(ThreadWriter) * thread_writer,
                             htf_timestamp_t ts,
                             HTF(AttributeList) * attribute_list);
 
+/* Measurement */
+
+/** Suspends the recording of the Events of the ThreadWriter, until htf_measurement_on is called.
+ *
+ * A MeasurementOnOff marker is recorded at the given time, so that the readers know about the gap. While the
+ * recording is suspended, each htf_record_* call only costs a relaxed atomic load. Like them, this must be called
+ * by the thread that records the Events. */
+extern void htf_measurement_off(HTF(ThreadWriter) * thread_writer, htf_timestamp_t time);
+
+/** Resumes the recording of the Events of the ThreadWriter, and records a MeasurementOnOff marker at the given time.
+ * The calls that started or ended while the recording was suspended are accounted for, so that the next Events are
+ * stored at the right level of the callstack. */
+extern void htf_measurement_on(HTF(ThreadWriter) * thread_writer, htf_timestamp_t time);
+
+/* Streams */
+
+/** Opens `nb_streams` ThreadWriters that are all recorded by the calling thread, such as the streams of a GPU or the
+ * logical tasks run by that thread. They record on the Locations first_thread_id to first_thread_id + nb_streams - 1,
+ * which are defined like for htf_write_thread_open.
+ *
+ * Each stream has its own timestamps and durations, so the Events of the streams may be recorded in any order. The
+ * streams are allocated at once, and they share the ring budget of a single thread with the asynchronous recording
+ * or a collector. Returns an array of `nb_streams` ThreadWriters, to be closed with htf_write_streams_close. */
+extern HTF(ThreadWriter) * htf_write_streams_open(HTF(Archive) * archive,
+                                                  HTF(ThreadId) first_thread_id,
+                                                  unsigned nb_streams);
+
+/** Closes the ThreadWriters returned by htf_write_streams_open, and frees them. */
+extern void htf_write_streams_close(HTF(ThreadWriter) * streams, unsigned nb_streams);
+
+/* Thread pool */
+
+/** Returns a ThreadWriter for a short-lived thread, taken from the ThreadWriterPool.
+ *
+ * The Location `thread_id` is defined in `global_archive` with `name` and `parent`, and a Thread is opened on it in
+ * `archive`, in a ThreadWriter whose buffers are reused from a previous thread. With the poolLogicalLocations
+ * parameter, the ThreadWriter of a thread of `archive` that ended is returned instead, still open: the thread then
+ * records on its logical Location, whose id is thread_writer->thread_trace.id, and `thread_id` is not defined. */
+extern HTF(ThreadWriter) * htf_thread_writer_acquire(HTF(Archive) * archive,
+                                                     HTF(ThreadId) thread_id,
+                                                     HTF(Archive) * global_archive,
+                                                     HTF(StringRef) name,
+                                                     HTF(LocationGroupId) parent);
+
+/** Gives back a ThreadWriter returned by htf_thread_writer_acquire, when its thread ends.
+ * Its Thread is closed and stored by a background thread, or when its Archive is closed with the
+ * poolLogicalLocations parameter. The ThreadWriter must not be used anymore. */
+extern void htf_thread_writer_release(HTF(ThreadWriter) * thread_writer);
+
+/* Event handles */
+
+/** Registers the Event made of the given record and payload in the ThreadWriter, and returns its id.
+ *
+ * The id can then be given to htf_record_event_by_id as many times as needed, which skips building the Event
+ * and looking it up. The payload is the data that htf_record_<record> would push, eg. the RegionRef of an Enter.
+ * The fields of the payload selected by the volatileFields parameter are recorded as 0.
+ * If the Event is an Enter or a Leave of a filtered Region, returns HTF_TOKEN_ID_FILTERED, which records nothing. */
+extern HTF(TokenId) htf_register_event_template(HTF(ThreadWriter) * thread_writer,
+                                                enum HTF(Record) record,
+                                                const void* payload,
+                                                size_t payload_size);
+
+/** Records an occurence of an Event registered with htf_register_event_template. */
+extern void htf_record_event_by_id(HTF(ThreadWriter) * thread_writer,
+                                   HTF(TokenId) id,
+                                   htf_timestamp_t time,
+                                   HTF(AttributeList) * attribute_list);
+
 /* Event Records */
 
 extern void htf_record_enter(HTF(ThreadWriter) * thread_writer,
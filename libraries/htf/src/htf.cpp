@@ -4,6 +4,8 @@
  */
 
 #include "htf/htf.h"
+#include <algorithm>
+#include <cstring>
 #include "htf/htf_archive.h"
 
 namespace htf {
@@ -117,43 +119,125 @@ Thread::Thread() {
   events = nullptr;
   nb_allocated_events = 0;
   nb_events = 0;
+  event_index = nullptr;
+  event_index_size = 0;
 
   sequences = nullptr;
   nb_allocated_sequences = 0;
   nb_sequences = 0;
+  sequence_index = nullptr;
+  sequence_index_size = 0;
  
   loops = 0;
   nb_allocated_loops = 0;
   nb_loops = 0;
+  loop_index = nullptr;
+  loop_index_size = 0;
+
+  arena = nullptr;
 }
 
-void Thread::initThread(Archive* a, ThreadId thread_id) {
+void Thread::initThread(Archive* a, ThreadId thread_id, Arena* writer_arena, bool keep_arrays) {
   archive = a;
   id = thread_id;
-
-  nb_allocated_events = NB_EVENT_DEFAULT;
-  events = new EventSummary[nb_allocated_events];
+  arena = writer_arena;
+
+  if (!keep_arrays) {
+    // These arrays grow with DOUBLE_MEMORY_SPACE, so they have to come from malloc.
+    nb_allocated_events = NB_EVENT_DEFAULT;
+    events = (EventSummary*)calloc(nb_allocated_events, sizeof(EventSummary));
+    event_index = nullptr;
+    event_index_size = 0;
+
+    nb_allocated_sequences = NB_SEQUENCE_DEFAULT;
+    sequences = (Sequence**)calloc(nb_allocated_sequences, sizeof(Sequence*));
+    sequence_index = nullptr;
+    sequence_index_size = 0;
+
+    nb_allocated_loops = NB_LOOP_DEFAULT;
+    loops = (Loop*)calloc(nb_allocated_loops, sizeof(Loop));
+    loop_index = nullptr;
+    loop_index_size = 0;
+  }
   nb_events = 0;
-
-  nb_allocated_sequences = NB_SEQUENCE_DEFAULT;
-  sequences = new Sequence*[nb_allocated_sequences];
+  // Only the main sequence exists for now, the others are created when they are first recorded.
+  sequences[0] = newSequence();
   nb_sequences = 0;
-
-  nb_allocated_loops = NB_LOOP_DEFAULT;
-  loops = new Loop[nb_allocated_loops];
   nb_loops = 0;
 
+  max_loop_lengths = nullptr;
+  nb_max_loop_lengths = 0;
+  degradations = 0;
+  nb_dropped_attributes = 0;
+  nb_late_events = 0;
+
   pthread_mutex_lock(&archive->lock);
   while (archive->nb_threads >= archive->nb_allocated_threads) {
     DOUBLE_MEMORY_SPACE(archive->threads, archive->nb_allocated_threads, Thread*);
   }
-  for (int i = 0; i < nb_allocated_sequences; i++) {
-    sequences[i] = new Sequence();
-  }
   archive->threads[archive->nb_threads++] = this;
   pthread_mutex_unlock(&archive->lock);
 }
 
+LinkedVector* Thread::newDurations() {
+  if (arena)
+    return arena->create<LinkedVector>(arena);
+  return new LinkedVector();
+}
+
+Sequence* Thread::newSequence() {
+  if (arena)
+    return arena->create<Sequence>(newDurations());
+  return new Sequence();
+}
+
+void Thread::releaseThread() {
+  // The Sequences, the durations and the attribute buffers belong to the arena, which is released by its owner.
+  for (unsigned i = 0; i < nb_loops; i++)
+    loops[i].~Loop();
+  free(loops);
+  free(loop_index);
+  free(sequences);
+  delete[] sequence_index;
+  free(events);
+  delete[] event_index;
+
+  events = nullptr;
+  nb_allocated_events = nb_events = 0;
+  event_index = nullptr;
+  event_index_size = 0;
+  sequences = nullptr;
+  nb_allocated_sequences = nb_sequences = 0;
+  sequence_index = nullptr;
+  sequence_index_size = 0;
+  loops = nullptr;
+  nb_allocated_loops = nb_loops = 0;
+  loop_index = nullptr;
+  loop_index_size = 0;
+  max_loop_lengths = nullptr;
+  nb_max_loop_lengths = 0;
+  arena = nullptr;
+}
+
+void Thread::clearThread() {
+  for (unsigned i = 0; i < nb_loops; i++)
+    loops[i].~Loop();
+  // The arrays are left as initThread allocates them: zeroed, and with empty indexes.
+  memset(events, 0, nb_allocated_events * sizeof(EventSummary));
+  memset(sequences, 0, nb_allocated_sequences * sizeof(Sequence*));
+  memset(loops, 0, nb_allocated_loops * sizeof(Loop));
+  std::fill_n(event_index, event_index_size, HTF_TOKEN_ID_INVALID);
+  std::fill_n(sequence_index, sequence_index_size, HTF_TOKEN_ID_INVALID);
+  std::fill_n(loop_index, loop_index_size, HTF_TOKEN_ID_INVALID);
+
+  nb_events = 0;
+  nb_sequences = 0;
+  nb_loops = 0;
+  max_loop_lengths = nullptr;
+  nb_max_loop_lengths = 0;
+  arena = nullptr;
+}
+
 /**
  * Returns a Thread's name.
  */
@@ -5,7 +5,9 @@
 
 #include "htf/htf_archive.h"
 #include "htf/htf.h"
+#include "htf/htf_collector.h"
 #include "htf/htf_dbg.h"
+#include "htf/htf_filter.h"
 #include "htf/htf_write.h"
 
 namespace htf {
@@ -190,6 +192,14 @@ void Archive::addString(StringRef string_ref, const char* string) {
   pthread_mutex_lock(&lock);
   definitions.addString(string_ref, string);
   pthread_mutex_unlock(&lock);
+  regionFilter.addString(string_ref, string);
+
+  if (auto* client = CollectorClient::get()) {
+    StringMessage m;
+    m.archive = (uintptr_t)this;
+    m.string_ref = string_ref;
+    client->send(m, string, strlen(string) + 1);
+  }
 }
 
 /**
@@ -201,6 +211,15 @@ void Archive::addRegion(RegionRef region_ref, StringRef name_ref) {
   pthread_mutex_lock(&lock);
   definitions.addRegion(region_ref, name_ref);
   pthread_mutex_unlock(&lock);
+  regionFilter.addRegion(region_ref, name_ref);
+
+  if (auto* client = CollectorClient::get()) {
+    RegionMessage m;
+    m.archive = (uintptr_t)this;
+    m.region_ref = region_ref;
+    m.string_ref = name_ref;
+    client->send(m);
+  }
 }
 
 /**
@@ -212,6 +231,16 @@ void Archive::addAttribute(AttributeRef attribute_ref, StringRef name_ref, Strin
   pthread_mutex_lock(&lock);
   definitions.addAttribute(attribute_ref, name_ref, description_ref, type);
   pthread_mutex_unlock(&lock);
+
+  if (auto* client = CollectorClient::get()) {
+    AttributeMessage m;
+    m.archive = (uintptr_t)this;
+    m.attribute_ref = attribute_ref;
+    m.name = name_ref;
+    m.description = description_ref;
+    m.attribute_type = type;
+    client->send(m);
+  }
 }
 } /* namespace htf*/
 
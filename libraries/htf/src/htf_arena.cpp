@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+
+#include "htf/htf_arena.h"
+#include <cstdlib>
+#include "htf/htf_dbg.h"
+using namespace htf;
+
+/** Size of the first chunk of an Arena. */
+#define ARENA_CHUNK_SIZE_DEFAULT (64 * 1024)
+/** Chunks stop doubling in size once they reach that size. */
+#define ARENA_CHUNK_SIZE_MAX (16 * 1024 * 1024)
+
+Arena::Arena() {
+  next_chunk_size = ARENA_CHUNK_SIZE_DEFAULT;
+}
+
+void* Arena::allocateFromNewChunk(size_t size, size_t alignment) {
+  // Large allocations get a chunk of their own, so that they do not waste the end of the current chunk.
+  bool dedicated = size + alignment > next_chunk_size / 4;
+  size_t chunk_size = dedicated ? size + alignment : next_chunk_size;
+
+  auto* chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + chunk_size));
+  if (chunk == nullptr)
+    htf_error("Failed to allocate a chunk of %zu bytes\n", chunk_size);
+  htf_log(DebugLevel::Debug, "Arena %p: new chunk of %zu bytes\n", this, chunk_size);
+  chunk->size = chunk_size;
+  allocated += chunk_size;
+  auto* data = reinterpret_cast<uint8_t*>(chunk + 1);
+  auto p = (reinterpret_cast<uintptr_t>(data) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+
+  if (dedicated && last_chunk) {
+    // Keep on handing out memory from the current chunk.
+    chunk->previous = last_chunk->previous;
+    last_chunk->previous = chunk;
+    return reinterpret_cast<void*>(p);
+  }
+
+  chunk->previous = last_chunk;
+  last_chunk = chunk;
+  cursor = reinterpret_cast<uint8_t*>(p + size);
+  limit = data + chunk_size;
+  if (!dedicated && next_chunk_size < ARENA_CHUNK_SIZE_MAX)
+    next_chunk_size *= 2;
+  return reinterpret_cast<void*>(p);
+}
+
+void Arena::release() {
+  for (auto f = finalizers.rbegin(); f != finalizers.rend(); ++f)
+    f->destroy(f->object);
+  finalizers.clear();
+  finalizers.shrink_to_fit();
+
+  while (last_chunk) {
+    Chunk* previous = last_chunk->previous;
+    free(last_chunk);
+    last_chunk = previous;
+  }
+  cursor = nullptr;
+  limit = nullptr;
+  allocated = 0;
+  next_chunk_size = ARENA_CHUNK_SIZE_DEFAULT;
+}
+
+void Arena::reset() {
+  for (auto f = finalizers.rbegin(); f != finalizers.rend(); ++f)
+    f->destroy(f->object);
+  finalizers.clear();
+  if (!last_chunk)
+    return;
+
+  // The current chunk is the largest one that is not dedicated to a single allocation.
+  Chunk* chunk = last_chunk->previous;
+  while (chunk) {
+    Chunk* previous = chunk->previous;
+    free(chunk);
+    chunk = previous;
+  }
+  last_chunk->previous = nullptr;
+  cursor = reinterpret_cast<uint8_t*>(last_chunk + 1);
+  limit = cursor + last_chunk->size;
+  allocated = last_chunk->size;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+
+#include "htf/htf_async.h"
+#include <algorithm>
+#include <chrono>
+#include "htf/htf_dbg.h"
+#include "htf/htf_parameter_handler.h"
+#include "htf/htf_write.h"
+using namespace htf;
+
+/** How long an encoder sleeps when all of its rings are empty. */
+#define ASYNC_ENCODER_IDLE_WAIT std::chrono::microseconds(200)
+/** Room for the AttributeLists in an EventRing, per AsyncEvent. Past that, the producer stores its Events itself. */
+#define ASYNC_ATTRIBUTE_BYTES_PER_EVENT 32
+
+/** Protects the pool of encoders. */
+static std::mutex encoders_lock;
+/** The running encoders. */
+static std::vector<AsyncEncoder*> encoders;
+/** Number of ThreadWriters attached to the encoders. */
+static size_t nb_attached_writers = 0;
+/** Encoder to which the next ThreadWriter is given. */
+static size_t next_encoder = 0;
+
+EventRing::EventRing(size_t size) {
+  size_t nb_slots = 16;
+  while (nb_slots < size)
+    nb_slots *= 2;
+  slots.resize(nb_slots);
+  mask = nb_slots - 1;
+  // Twice the largest AttributeList, so that any of them fits once the ring is drained.
+  attributes.resize(std::max(nb_slots * ASYNC_ATTRIBUTE_BYTES_PER_EVENT, 2 * ATTRIBUTE_MAX_BUFFER_SIZE));
+}
+
+AsyncEncoder::AsyncEncoder() {
+  thread = std::thread(&AsyncEncoder::run, this);
+}
+
+AsyncEncoder::~AsyncEncoder() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  wake_up.notify_one();
+  thread.join();
+}
+
+void AsyncEncoder::run() {
+  // Whatever this thread does must not be recorded.
+  htf_recursion_shield++;
+  while (true) {
+    // The lock is released between two passes, so that ThreadWriters can be attached and detached.
+    std::unique_lock<std::mutex> guard(lock);
+    if (stop)
+      break;
+    size_t nb_encoded = 0;
+    for (auto* writer : writers)
+      nb_encoded += writer->encodeRing();
+    if (nb_encoded == 0)
+      wake_up.wait_for(guard, ASYNC_ENCODER_IDLE_WAIT);
+  }
+}
+
+void AsyncEncoder::attach(ThreadWriter* writer) {
+  std::lock_guard<std::mutex> pool_guard(encoders_lock);
+  if (encoders.empty()) {
+    size_t nb_encoders = parameterHandler.getAsyncEncoders();
+    htf_log(DebugLevel::Verbose, "Starting %zu asynchronous encoders\n", nb_encoders);
+    for (size_t i = 0; i < nb_encoders; i++)
+      encoders.push_back(new AsyncEncoder());
+  }
+  auto* encoder = encoders[next_encoder++ % encoders.size()];
+  auto* ring = static_cast<EventRing*>(writer->ring);
+  ring->encoder = encoder;
+  std::lock_guard<std::mutex> guard(encoder->lock);
+  encoder->writers.push_back(writer);
+  nb_attached_writers++;
+}
+
+void AsyncEncoder::detach(ThreadWriter* writer) {
+  auto* ring = static_cast<EventRing*>(writer->ring);
+  auto* encoder = ring->encoder;
+  {
+    // The encoder holds its lock while it drains the rings, so the writer is not being encoded once we get it.
+    std::lock_guard<std::mutex> guard(encoder->lock);
+    auto& w = encoder->writers;
+    w.erase(std::remove(w.begin(), w.end(), writer), w.end());
+  }
+  ring->encoder = nullptr;
+
+  std::lock_guard<std::mutex> pool_guard(encoders_lock);
+  if (--nb_attached_writers == 0) {
+    htf_log(DebugLevel::Verbose, "Stopping the asynchronous encoders\n");
+    for (auto* e : encoders)
+      delete e;
+    encoders.clear();
+    next_encoder = 0;
+  }
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
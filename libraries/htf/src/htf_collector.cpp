@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+
+#include "htf/htf_collector.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include "htf/htf_dbg.h"
+#include "htf/htf_parameter_handler.h"
+using namespace htf;
+
+/** Number of times a producer spins on a full ring before it starts sleeping. */
+#define COLLECTOR_SPIN_TRIES 1000
+/** How long a producer sleeps between two tries once it stopped spinning. */
+#define COLLECTOR_WAIT std::chrono::microseconds(100)
+/** Number of tries after which a producer warns that the collector is not draining its rings (about 1 second). */
+#define COLLECTOR_WARN_TRIES (COLLECTOR_SPIN_TRIES + 10000)
+
+/** Size of the smallest ring. Any Event with its AttributeList fits in it: sendTo never drops one. */
+#define SHARED_RING_MIN_SIZE 4096
+static_assert(SharedRing::messageSize<EventMessage>(sizeof(Event) + sizeof(AttributeList)) <= SHARED_RING_MIN_SIZE,
+              "An Event message must fit in the smallest ring");
+static_assert(SharedRing::messageSize<EventByIdMessage>(sizeof(AttributeList)) <= SHARED_RING_MIN_SIZE,
+              "An Event message must fit in the smallest ring");
+
+/** Whether CollectorClient::disable was called. */
+static bool client_disabled = false;
+
+std::string htf::sharedRingName(const char* collector_name, uint32_t index) {
+  std::string name = std::string("/") + collector_name;
+  if (index > 0)
+    name += "." + std::to_string(index);
+  return name;
+}
+
+SharedRing* htf::createSharedRing(const std::string& name, size_t size) {
+  size_t data_size = SHARED_RING_MIN_SIZE;
+  while (data_size < size)
+    data_size *= 2;
+  size_t mapping_size = sizeof(SharedRing) + data_size;
+
+  // A ring left behind by a process that crashed before its collector could remove it is replaced.
+  shm_unlink(name.c_str());
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    htf_error("Cannot create the shared memory %s: %s\n", name.c_str(), strerror(errno));
+  if (ftruncate(fd, mapping_size) < 0)
+    htf_error("Cannot resize the shared memory %s: %s\n", name.c_str(), strerror(errno));
+  void* addr = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    htf_error("Cannot map the shared memory %s: %s\n", name.c_str(), strerror(errno));
+
+  auto* ring = static_cast<SharedRing*>(addr);
+  ring->size = data_size;
+  ring->producer = getpid();
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->tail.store(0, std::memory_order_relaxed);
+  // The collector may map the ring at any time: it only reads it once it is marked as initialized.
+  ring->magic.store(SharedRing::magic_value, std::memory_order_release);
+  return ring;
+}
+
+SharedRing* htf::openSharedRing(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SharedRing)) {
+    close(fd);
+    return nullptr;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    htf_error("Cannot map the shared memory %s: %s\n", name.c_str(), strerror(errno));
+
+  auto* ring = static_cast<SharedRing*>(addr);
+  if (ring->magic.load(std::memory_order_acquire) != SharedRing::magic_value ||
+      sizeof(SharedRing) + ring->size != (size_t)st.st_size) {
+    munmap(addr, st.st_size);
+    return nullptr;
+  }
+  return ring;
+}
+
+void htf::closeSharedRing(SharedRing* ring) {
+  munmap(ring, sizeof(SharedRing) + ring->size);
+}
+
+CollectorClient::CollectorClient(const char* collector_name) : name(collector_name) {
+  control = createSharedRing(sharedRingName(collector_name, 0), parameterHandler.getCollectorRingSize());
+  htf_log(DebugLevel::Verbose, "Sending the trace to the collector %s\n", collector_name);
+}
+
+CollectorClient* CollectorClient::get() {
+  if (client_disabled || !parameterHandler.getCollector())
+    return nullptr;
+  static auto* client = new CollectorClient(parameterHandler.getCollector());
+  return client;
+}
+
+void CollectorClient::disable() {
+  client_disabled = true;
+}
+
+void CollectorClient::waitForCollector(size_t nb_tries) {
+  if (nb_tries < COLLECTOR_SPIN_TRIES) {
+    sched_yield();
+    return;
+  }
+  if (nb_tries == COLLECTOR_WARN_TRIES)
+    htf_warn("The collector %s does not drain its rings: is htf_collector running?\n", parameterHandler.getCollector());
+  std::this_thread::sleep_for(COLLECTOR_WAIT);
+}
+
+void CollectorClient::sendClock() {
+  ClockMessage m;
+  m.clock = htf_get_clock_info();
+  send(m);
+}
+
+CollectorThread* CollectorClient::openThread(uint64_t archive, ThreadId thread_id, size_t ring_size) {
+  uint32_t index = next_ring++;
+  auto* thread = new CollectorThread();
+  thread->client = this;
+  thread->ring = createSharedRing(sharedRingName(name.c_str(), index), ring_size);
+
+  ThreadOpenMessage m;
+  m.archive = archive;
+  m.thread_id = thread_id;
+  m.ring_index = index;
+  send(m);
+  return thread;
+}
+
+void CollectorClient::closeThread(CollectorThread* thread) {
+  ThreadCloseMessage m;
+  sendTo(thread->ring, m);
+  // The collector removes the shared memory once it has read this last message.
+  closeSharedRing(thread->ring);
+  delete thread;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+
+#include "htf/htf_filter.h"
+#include <algorithm>
+#include "htf/htf_dbg.h"
+#include "htf/htf_parameter_handler.h"
+using namespace htf;
+
+RegionFilter htf::regionFilter;
+
+void RegionFilter::filter(RegionRef region_ref) {
+  const std::vector<uint64_t>* current = bitmap.load(std::memory_order_relaxed);
+  auto* b = current ? new std::vector<uint64_t>(*current) : new std::vector<uint64_t>();
+  if (region_ref / 64 >= b->size())
+    b->resize(std::max<size_t>(region_ref / 64 + 1, 2 * b->size()));
+  (*b)[region_ref / 64] |= (uint64_t)1 << (region_ref % 64);
+  bitmap.store(b, std::memory_order_release);
+  if (current)
+    old_bitmaps.push_back(current);
+}
+
+void RegionFilter::addString(StringRef string_ref, const char* string) {
+  if (!parameterHandler.hasRegionFilter())
+    return;
+  std::lock_guard<std::mutex> guard(lock);
+  strings[string_ref] = string;
+  // Some Regions may have been registered before their name.
+  auto [begin, end] = unnamed_regions.equal_range(string_ref);
+  for (auto it = begin; it != end; ++it) {
+    if (!parameterHandler.isRegionRecorded(string)) {
+      htf_log(DebugLevel::Verbose, "Region %u (%s) is not recorded\n", it->second, string);
+      filter(it->second);
+    }
+  }
+  unnamed_regions.erase(string_ref);
+}
+
+void RegionFilter::addRegion(RegionRef region_ref, StringRef name_ref) {
+  if (!parameterHandler.hasRegionFilter())
+    return;
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = strings.find(name_ref);
+  if (it == strings.end()) {
+    unnamed_regions.emplace(name_ref, region_ref);
+    return;
+  }
+  if (!parameterHandler.isRegionRecorded(it->second.c_str())) {
+    htf_log(DebugLevel::Verbose, "Region %u (%s) is not recorded\n", region_ref, it->second.c_str());
+    filter(region_ref);
+  }
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
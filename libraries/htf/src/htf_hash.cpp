@@ -72,7 +72,10 @@ void hash32(const void* key, const size_t len, const uint32_t seed, uint32_t* ou
   // But that might lead to some unforeseen consequences
   // Or ! We simply take that into account, and change the "true_len" variable
   // For now we'll try the second one, and see what it does.
-  const size_t true_len = len * (sizeof(htf::Token) / sizeof(uint8_t));
+  hash32Bytes(key, len * (sizeof(htf::Token) / sizeof(uint8_t)), seed, out);
+}
+
+void hash32Bytes(const void* key, const size_t true_len, const uint32_t seed, uint32_t* out) {
   const uint8_t* data = (const uint8_t*)key;
   const int nblocks = true_len / 4;
 
@@ -259,6 +262,13 @@ void hash64(const void* key, const size_t len, const uint32_t seed, uint64_t* ou
   ((uint64_t*)out)[0] = h1;
   //	((uint64_t*)out)[1] = h2;
 }
+
+uint32_t hashTokens(const Token* tokens, size_t len) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < len; i++)
+    hash = hashAppend(hash, tokens[i]);
+  return hashFold(hash);
+}
 }  // namespace htf
 /* -*-
    mode: c;
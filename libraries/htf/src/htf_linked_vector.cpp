@@ -8,14 +8,29 @@
 using namespace htf;
 
 LinkedVector::LinkedVector() {
-  first = new SubVector(defaultSize);
-  last = first;
+  first = nullptr;
+  last = nullptr;
+}
+
+LinkedVector::LinkedVector(Arena* a) {
+  first = nullptr;
+  last = nullptr;
+  arena = a;
+}
+
+LinkedVector::SubVector* LinkedVector::newSubVector(size_t n, SubVector* previous) {
+  if (!arena)
+    return new SubVector(n, previous);
+  return arena->create<SubVector>(n, arena->allocateArray<uint64_t>(n), previous);
 }
 
 uint64_t& LinkedVector::add(uint64_t val) {
-  if (this->last->size >= this->last->allocated) {
+  if (!last) {
+    first = newSubVector(defaultSize, nullptr);
+    last = first;
+  } else if (last->size >= last->allocated) {
     htf_log(DebugLevel::Debug, "Adding a new tail to an array: %p\n", this);
-    last = new SubVector(defaultSize, last);
+    last = newSubVector(last->allocated * 2, last);
   }
   size++;
   return last->add(val);
@@ -40,10 +55,14 @@ uint64_t& LinkedVector::operator[](size_t pos) const {
 }
 
 uint64_t& LinkedVector::front() const {
+  if (size == 0)
+    htf_error("Getting the first element of an empty vector\n");
   return first->at(0);
 }
 
 uint64_t& LinkedVector::back() const {
+  if (size == 0)
+    htf_error("Getting the last element of an empty vector\n");
   return last->at(size - 1);
 }
 
@@ -5,8 +5,11 @@
 
 #include <json/json.h>
 #include <json/value.h>
+#include <fnmatch.h>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include "htf/htf_dbg.h"
 #include "htf/htf_parameter_handler.h"
 
@@ -35,6 +38,15 @@
       htf_warn("Parameter in \"" #parameterName "\" field was invalid: %s\n", config[#parameterName].asCString()); \
     }                                                                                                              \
   }
+/** Small macro to load a field that's supposed to be a boolean, and throw a warning in case something goes wrong. */
+#define LOAD_FIELD_BOOL(parameterName)                                    \
+  if (config[#parameterName]) {                                           \
+    if (config[#parameterName].isBool()) {                                \
+      parameterName = config[#parameterName].asBool();                    \
+    } else {                                                              \
+      htf_warn("Parameter in \"" #parameterName "\" field was invalid\n"); \
+    }                                                                     \
+  }
 
 /** Small macro that is used when getting parameters from environment variables.*/
 #define GET_ENV_FIELD(parameterName, enumName, enumSpecific) \
@@ -43,6 +55,55 @@
 
 namespace htf {
 const char* defaultPath = "config.json";
+
+/** Parses the value of a boolean environment variable. */
+static bool _parse_bool(const char* value) {
+  return strcmp(value, "TRUE") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+}
+
+/** Parses a comma-separated list of VolatileField names, and returns their combination. */
+static uint32_t _parse_volatile_fields(const std::string& list) {
+  uint32_t fields = 0;
+  std::stringstream stream(list);
+  std::string name;
+  while (std::getline(stream, name, ',')) {
+    if (name == "RequestID")
+      fields |= (uint32_t)VolatileField::RequestID;
+    else if (name == "MessageLength")
+      fields |= (uint32_t)VolatileField::MessageLength;
+    else if (name == "MessageTag")
+      fields |= (uint32_t)VolatileField::MessageTag;
+    else if (name != "None")
+      htf_warn("Unknown volatile field: %s\n", name.c_str());
+  }
+  return fields;
+}
+/** Parses a comma-separated list of globs. */
+static std::vector<std::string> _parse_globs(const std::string& list) {
+  std::vector<std::string> globs;
+  std::stringstream stream(list);
+  std::string glob;
+  while (std::getline(stream, glob, ','))
+    if (!glob.empty())
+      globs.push_back(glob);
+  return globs;
+}
+
+/** Returns whether a name matches one of the globs. */
+static bool _match_globs(const std::vector<std::string>& globs, const char* name) {
+  for (auto& glob : globs)
+    if (fnmatch(glob.c_str(), name, 0) == 0)
+      return true;
+  return false;
+}
+
+/** Joins a list of globs with commas. */
+static std::string _globs_to_string(const std::vector<std::string>& globs) {
+  std::string list;
+  for (auto& glob : globs)
+    list += (list.empty() ? "" : ",") + glob;
+  return list;
+}
 const ParameterHandler parameterHandler = ParameterHandler();
 
 ParameterHandler::ParameterHandler() {
@@ -89,9 +150,59 @@ ParameterHandler::ParameterHandler() {
     MATCH_LOOP_FINDING_ENUM(Basic);
     MATCH_LOOP_FINDING_ENUM(BasicTruncated);
     MATCH_LOOP_FINDING_ENUM(Filter);
+    MATCH_LOOP_FINDING_ENUM(RollingHash);
+  });
+#define MATCH_CLOCK_ENUM(value) MATCH_ENUM(clockSource, ClockSource, value)
+  LOAD_FIELD_ENUM(clockSource, {
+    MATCH_CLOCK_ENUM(Monotonic);
+    MATCH_CLOCK_ENUM(MonotonicRaw);
+    MATCH_CLOCK_ENUM(MonotonicCoarse);
+    MATCH_CLOCK_ENUM(TSC);
   });
   LOAD_FIELD_UINT64(maxLoopLength);
+  LOAD_FIELD_BOOL(adaptiveLoopLength);
   LOAD_FIELD_UINT64(zstdCompressionLevel);
+  if (config["volatileFields"]) {
+    if (config["volatileFields"].isString()) {
+      volatileFields = _parse_volatile_fields(config["volatileFields"].asString());
+    } else {
+      htf_warn("Parameter in \"volatileFields\" field was invalid\n");
+    }
+  }
+  LOAD_FIELD_BOOL(parametricLoops);
+  LOAD_FIELD_BOOL(asyncRecording);
+  LOAD_FIELD_UINT64(asyncRingSize);
+  LOAD_FIELD_UINT64(asyncEncoders);
+  if (config["collector"]) {
+    if (config["collector"].isString()) {
+      collector = config["collector"].asString();
+    } else {
+      htf_warn("Parameter in \"collector\" field was invalid\n");
+    }
+  }
+  LOAD_FIELD_UINT64(collectorRingSize);
+  if (config["includeRegions"]) {
+    if (config["includeRegions"].isString()) {
+      includeRegions = _parse_globs(config["includeRegions"].asString());
+    } else {
+      htf_warn("Parameter in \"includeRegions\" field was invalid\n");
+    }
+  }
+  if (config["excludeRegions"]) {
+    if (config["excludeRegions"].isString()) {
+      excludeRegions = _parse_globs(config["excludeRegions"].asString());
+    } else {
+      htf_warn("Parameter in \"excludeRegions\" field was invalid\n");
+    }
+  }
+  LOAD_FIELD_UINT64(aggregationMinRate);
+  LOAD_FIELD_UINT64(aggregationMaxDuration);
+  LOAD_FIELD_UINT64(maxEvents);
+  LOAD_FIELD_UINT64(maxSequences);
+  LOAD_FIELD_UINT64(maxAttributeBufferSize);
+  LOAD_FIELD_BOOL(poolLogicalLocations);
+  LOAD_FIELD_UINT64(reorderWindow);
+  LOAD_FIELD_UINT64(reorderBufferSize);
 
   /* Override from Environment Variables */
 
@@ -126,6 +237,20 @@ ParameterHandler::ParameterHandler() {
     GET_LOOP_FIELD(None);
     GET_LOOP_FIELD(Basic);
     GET_LOOP_FIELD(BasicTruncated);
+    GET_LOOP_FIELD(Filter);
+    GET_LOOP_FIELD(RollingHash);
+  }
+
+#define GET_CLOCK_FIELD(value)  \
+  if (clockString == #value) \
+  clockSource = ClockSource::value
+  char* clockChar = std::getenv("HTF_CLOCK");
+  if (clockChar) {
+    std::string clockString = clockChar;
+    GET_CLOCK_FIELD(Monotonic);
+    GET_CLOCK_FIELD(MonotonicRaw);
+    GET_CLOCK_FIELD(MonotonicCoarse);
+    GET_CLOCK_FIELD(TSC);
   }
 
   char* zstdLevelChar = std::getenv("HTF_ZSTD_LVL");
@@ -138,13 +263,116 @@ ParameterHandler::ParameterHandler() {
     maxLoopLength = std::stoull(loopLengthChar);
   }
 
+  char* adaptiveLoopLengthChar = std::getenv("HTF_ADAPTIVE_LOOP_LENGTH");
+  if (adaptiveLoopLengthChar) {
+    adaptiveLoopLength = _parse_bool(adaptiveLoopLengthChar);
+  }
+
+  char* volatileFieldsChar = std::getenv("HTF_VOLATILE_FIELDS");
+  if (volatileFieldsChar) {
+    volatileFields = _parse_volatile_fields(volatileFieldsChar);
+  }
+
+  char* parametricLoopsChar = std::getenv("HTF_PARAMETRIC_LOOPS");
+  if (parametricLoopsChar) {
+    parametricLoops = _parse_bool(parametricLoopsChar);
+  }
+
+  char* asyncRecordingChar = std::getenv("HTF_ASYNC_RECORDING");
+  if (asyncRecordingChar) {
+    asyncRecording = _parse_bool(asyncRecordingChar);
+  }
+
+  char* asyncRingSizeChar = std::getenv("HTF_ASYNC_RING_SIZE");
+  if (asyncRingSizeChar) {
+    asyncRingSize = std::stoull(asyncRingSizeChar);
+  }
+
+  char* asyncEncodersChar = std::getenv("HTF_ASYNC_ENCODERS");
+  if (asyncEncodersChar) {
+    asyncEncoders = std::stoull(asyncEncodersChar);
+  }
+  if (asyncEncoders == 0) {
+    htf_warn("At least one asynchronous encoder is needed\n");
+    asyncEncoders = 1;
+  }
+
+  char* collectorChar = std::getenv("HTF_COLLECTOR");
+  if (collectorChar) {
+    collector = collectorChar;
+  }
+  if (collector.find('/') != std::string::npos) {
+    htf_warn("The name of the collector cannot contain '/': %s\n", collector.c_str());
+    collector.clear();
+  }
+
+  char* collectorRingSizeChar = std::getenv("HTF_COLLECTOR_RING_SIZE");
+  if (collectorRingSizeChar) {
+    collectorRingSize = std::stoull(collectorRingSizeChar);
+  }
+
+  char* includeRegionsChar = std::getenv("HTF_INCLUDE_REGIONS");
+  if (includeRegionsChar) {
+    includeRegions = _parse_globs(includeRegionsChar);
+  }
+
+  char* excludeRegionsChar = std::getenv("HTF_EXCLUDE_REGIONS");
+  if (excludeRegionsChar) {
+    excludeRegions = _parse_globs(excludeRegionsChar);
+  }
+
+  char* aggregationMinRateChar = std::getenv("HTF_AGGREGATION_MIN_RATE");
+  if (aggregationMinRateChar) {
+    aggregationMinRate = std::stoull(aggregationMinRateChar);
+  }
+
+  char* aggregationMaxDurationChar = std::getenv("HTF_AGGREGATION_MAX_DURATION");
+  if (aggregationMaxDurationChar) {
+    aggregationMaxDuration = std::stoull(aggregationMaxDurationChar);
+  }
+
+  char* maxEventsChar = std::getenv("HTF_MAX_EVENTS");
+  if (maxEventsChar) {
+    maxEvents = std::stoull(maxEventsChar);
+  }
+
+  char* maxSequencesChar = std::getenv("HTF_MAX_SEQUENCES");
+  if (maxSequencesChar) {
+    maxSequences = std::stoull(maxSequencesChar);
+  }
+
+  char* maxAttributeBufferSizeChar = std::getenv("HTF_MAX_ATTRIBUTE_BUFFER_SIZE");
+  if (maxAttributeBufferSizeChar) {
+    maxAttributeBufferSize = std::stoull(maxAttributeBufferSizeChar);
+  }
+
+  char* poolLogicalLocationsChar = std::getenv("HTF_POOL_LOGICAL_LOCATIONS");
+  if (poolLogicalLocationsChar) {
+    poolLogicalLocations = _parse_bool(poolLogicalLocationsChar);
+  }
+
+  char* reorderWindowChar = std::getenv("HTF_REORDER_WINDOW");
+  if (reorderWindowChar) {
+    reorderWindow = std::stoull(reorderWindowChar);
+  }
+
+  char* reorderBufferSizeChar = std::getenv("HTF_REORDER_BUFFER_SIZE");
+  if (reorderBufferSizeChar) {
+    reorderBufferSize = std::stoull(reorderBufferSizeChar);
+  }
+
   htf_log(htf::DebugLevel::Verbose, "%s\n", to_string().c_str());
 }
 
 size_t ParameterHandler::getMaxLoopLength() const {
-  if (loopFindingAlgorithm == LoopFindingAlgorithm::BasicTruncated)
+  if (loopFindingAlgorithm == LoopFindingAlgorithm::BasicTruncated ||
+      loopFindingAlgorithm == LoopFindingAlgorithm::RollingHash)
     return maxLoopLength;
-  htf_error("Asked for the max loop length but wasn't using a LoopFindingBasicTruncated algorithm.\n");
+  htf_error("Asked for the max loop length but wasn't using a truncated loop finding algorithm.\n");
+}
+bool ParameterHandler::getAdaptiveLoopLength() const {
+  return adaptiveLoopLength && (loopFindingAlgorithm == LoopFindingAlgorithm::BasicTruncated ||
+                                loopFindingAlgorithm == LoopFindingAlgorithm::RollingHash);
 }
 u_int8_t ParameterHandler::getZstdCompressionLevel() const {
   if (compressionAlgorithm == CompressionAlgorithm::ZSTD) {
@@ -165,6 +393,62 @@ EncodingAlgorithm ParameterHandler::getEncodingAlgorithm() const {
 LoopFindingAlgorithm ParameterHandler::getLoopFindingAlgorithm() const {
   return loopFindingAlgorithm;
 }
+ClockSource ParameterHandler::getClockSource() const {
+  return clockSource;
+}
+uint32_t ParameterHandler::getVolatileFields() const {
+  return volatileFields;
+}
+bool ParameterHandler::getParametricLoops() const {
+  return parametricLoops;
+}
+bool ParameterHandler::getAsyncRecording() const {
+  return asyncRecording;
+}
+size_t ParameterHandler::getAsyncRingSize() const {
+  return asyncRingSize;
+}
+size_t ParameterHandler::getAsyncEncoders() const {
+  return asyncEncoders;
+}
+const char* ParameterHandler::getCollector() const {
+  return collector.empty() ? nullptr : collector.c_str();
+}
+size_t ParameterHandler::getCollectorRingSize() const {
+  return collectorRingSize;
+}
+bool ParameterHandler::hasRegionFilter() const {
+  return !includeRegions.empty() || !excludeRegions.empty();
+}
+bool ParameterHandler::isRegionRecorded(const char* name) const {
+  if (!includeRegions.empty() && !_match_globs(includeRegions, name))
+    return false;
+  return !_match_globs(excludeRegions, name);
+}
+uint64_t ParameterHandler::getAggregationMinRate() const {
+  return aggregationMinRate;
+}
+uint64_t ParameterHandler::getAggregationMaxDuration() const {
+  return aggregationMaxDuration;
+}
+uint64_t ParameterHandler::getMaxEvents() const {
+  return maxEvents;
+}
+uint64_t ParameterHandler::getMaxSequences() const {
+  return maxSequences;
+}
+uint64_t ParameterHandler::getMaxAttributeBufferSize() const {
+  return maxAttributeBufferSize;
+}
+bool ParameterHandler::getPoolLogicalLocations() const {
+  return poolLogicalLocations;
+}
+uint64_t ParameterHandler::getReorderWindow() const {
+  return reorderWindow;
+}
+uint64_t ParameterHandler::getReorderBufferSize() const {
+  return reorderBufferSize;
+}
 
 std::string ParameterHandler::to_string() const {
   std::stringstream stream("");
@@ -172,7 +456,26 @@ std::string ParameterHandler::to_string() const {
   stream << '\t' << R"("compressionAlgorithm": ")" << algorithmToString(compressionAlgorithm) << "\",\n";
   stream << '\t' << R"("encodingAlgorithm": ")" << algorithmToString(encodingAlgorithm) << "\",\n";
   stream << '\t' << R"("loopFindingAlgorithm": ")" << algorithmToString(loopFindingAlgorithm) << "\",\n";
+  stream << '\t' << R"("clockSource": ")" << algorithmToString(clockSource) << "\",\n";
+  stream << '\t' << R"("volatileFields": ")" << volatileFieldsToString(volatileFields) << "\",\n";
+  stream << '\t' << R"("parametricLoops": )" << (parametricLoops ? "true" : "false") << ",\n";
+  stream << '\t' << R"("asyncRecording": )" << (asyncRecording ? "true" : "false") << ",\n";
+  stream << '\t' << R"("asyncRingSize": )" << asyncRingSize << ",\n";
+  stream << '\t' << R"("asyncEncoders": )" << asyncEncoders << ",\n";
+  stream << '\t' << R"("collector": ")" << collector << "\",\n";
+  stream << '\t' << R"("collectorRingSize": )" << collectorRingSize << ",\n";
+  stream << '\t' << R"("includeRegions": ")" << _globs_to_string(includeRegions) << "\",\n";
+  stream << '\t' << R"("excludeRegions": ")" << _globs_to_string(excludeRegions) << "\",\n";
+  stream << '\t' << R"("aggregationMinRate": )" << aggregationMinRate << ",\n";
+  stream << '\t' << R"("aggregationMaxDuration": )" << aggregationMaxDuration << ",\n";
+  stream << '\t' << R"("maxEvents": )" << maxEvents << ",\n";
+  stream << '\t' << R"("maxSequences": )" << maxSequences << ",\n";
+  stream << '\t' << R"("maxAttributeBufferSize": )" << maxAttributeBufferSize << ",\n";
+  stream << '\t' << R"("poolLogicalLocations": )" << (poolLogicalLocations ? "true" : "false") << ",\n";
+  stream << '\t' << R"("reorderWindow": )" << reorderWindow << ",\n";
+  stream << '\t' << R"("reorderBufferSize": )" << reorderBufferSize << ",\n";
   stream << '\t' << R"("maxLoopLength": )" << maxLoopLength << ",\n";
+  stream << '\t' << R"("adaptiveLoopLength": )" << (adaptiveLoopLength ? "true" : "false") << ",\n";
   stream << '\t' << R"("zstdCompressionLevel": )" << zstdCompressionLevel << ",\n";
   stream << "}";
   return stream.str();
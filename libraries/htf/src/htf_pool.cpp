@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+
+#include "htf/htf_pool.h"
+#include <algorithm>
+#include "htf/htf_archive.h"
+#include "htf/htf_dbg.h"
+#include "htf/htf_parameter_handler.h"
+#include "htf/htf_write.h"
+using namespace htf;
+
+ThreadWriterPool htf::threadWriterPool;
+
+ThreadWriterPool::~ThreadWriterPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stop = true;
+  }
+  wake_up.notify_all();
+  if (closer.joinable())
+    closer.join();
+  for (auto* writer : free_writers) {
+    writer->freeBuffers();
+    delete writer;
+  }
+}
+
+void ThreadWriterPool::run() {
+  // Whatever this thread does must not be recorded.
+  htf_recursion_shield++;
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    wake_up.wait(guard, [this] { return stop || !to_close.empty(); });
+    if (to_close.empty())
+      break;
+    closing = to_close.front();
+    to_close.pop_front();
+    guard.unlock();
+    closing.writer->threadClose();
+    guard.lock();
+    used.erase(closing.writer);
+    free_writers.push_back(closing.writer);
+    closing = {nullptr, nullptr};
+    wake_up.notify_all();
+  }
+}
+
+bool ThreadWriterPool::isClosing(const Archive* archive) const {
+  if (closing.archive == archive)
+    return true;
+  return std::any_of(to_close.begin(), to_close.end(), [archive](const Entry& e) { return e.archive == archive; });
+}
+
+ThreadWriter* ThreadWriterPool::acquire(Archive* archive,
+                                        ThreadId thread_id,
+                                        Archive* global_archive,
+                                        StringRef name,
+                                        LocationGroupId parent) {
+  ThreadWriter* writer = nullptr;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (parameterHandler.getPoolLogicalLocations()) {
+      // The last ThreadWriter given back is the most likely to be in the cache.
+      auto it = std::find_if(open_writers.rbegin(), open_writers.rend(),
+                             [archive](const Entry& e) { return e.archive == archive; });
+      if (it != open_writers.rend()) {
+        writer = it->writer;
+        open_writers.erase(std::next(it).base());
+        return writer;
+      }
+    }
+    if (!free_writers.empty()) {
+      writer = free_writers.back();
+      free_writers.pop_back();
+    }
+  }
+
+  global_archive->defineLocation(thread_id, name, parent);
+  if (writer) {
+    writer->reopen(archive, thread_id);
+  } else {
+    htf_log(DebugLevel::Debug, "Adding a ThreadWriter to the pool for thread %u\n", thread_id);
+    writer = new ThreadWriter();
+    writer->open(archive, thread_id);
+    writer->recycled = 1;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  used[writer] = archive;
+  return writer;
+}
+
+void ThreadWriterPool::release(ThreadWriter* writer) {
+  std::unique_lock<std::mutex> guard(lock);
+  auto it = used.find(writer);
+  if (it == used.end())
+    htf_error("ThreadWriter %p does not come from the pool\n", writer);
+  Entry entry{writer, it->second};
+  if (parameterHandler.getPoolLogicalLocations()) {
+    if (writer->cur_depth > 0)
+      htf_warn("Thread %u is given back with %d calls still open\n", writer->thread_trace.id, writer->cur_depth);
+    open_writers.push_back(entry);
+    return;
+  }
+  to_close.push_back(entry);
+  if (!closer.joinable())
+    closer = std::thread(&ThreadWriterPool::run, this);
+  guard.unlock();
+  wake_up.notify_all();
+}
+
+void ThreadWriterPool::closeArchive(Archive* archive) {
+  std::unique_lock<std::mutex> guard(lock);
+  if (used.empty())
+    return;
+  // The logical Locations of the Archive are over: their Threads are stored here, like the other ones.
+  std::vector<ThreadWriter*> writers;
+  for (auto it = open_writers.begin(); it != open_writers.end();) {
+    if (it->archive == archive) {
+      writers.push_back(it->writer);
+      it = open_writers.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  wake_up.wait(guard, [this, archive] { return !isClosing(archive); });
+  guard.unlock();
+
+  for (auto* writer : writers)
+    writer->threadClose();
+  guard.lock();
+  for (auto* writer : writers) {
+    used.erase(writer);
+    free_writers.push_back(writer);
+  }
+}
+
+extern ThreadWriter* htf_thread_writer_acquire(Archive* archive,
+                                               ThreadId thread_id,
+                                               Archive* global_archive,
+                                               StringRef name,
+                                               LocationGroupId parent) {
+  return threadWriterPool.acquire(archive, thread_id, global_archive, name, parent);
+}
+
+extern void htf_thread_writer_release(ThreadWriter* thread_writer) {
+  threadWriterPool.release(thread_writer);
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
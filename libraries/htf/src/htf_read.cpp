@@ -8,6 +8,7 @@
 #include <cstdlib>
 #include <cstring>
 #include "htf/htf_archive.h"
+#include "htf/htf_record.h"
 
 namespace htf {
 ThreadReader::ThreadReader(const Archive* archive, ThreadId threadId, int options) {
@@ -113,7 +114,8 @@ bool ThreadReader::isEndOfSequence(int current_index, Token sequence_id) const {
 bool ThreadReader::isEndOfLoop(int current_index, Token loop_id) const {
   if (loop_id.type == TypeLoop) {
     auto* loop = thread_trace->getLoop(loop_id);
-    return current_index >= loop->nb_iterations.back();
+    // tokenCount was incremented when entering the Loop, so the current occurence is the previous one.
+    return current_index >= loop->nb_iterations.at(tokenCount.get_value(loop_id) - 1);
     // We are in a loop and index is beyond the number of iterations
   }
   htf_error("The given loop_id was the wrong type: %d\n", loop_id.type);
@@ -146,6 +148,11 @@ EventOccurence ThreadReader::getEventOccurence(Token event_id, int occurence_id)
     eventOccurence.duration = es->durations->at(occurence_id);
   }
   eventOccurence.attributes = getEventAttributeList(event_id, occurence_id);
+  eventOccurence.volatile_values = nullptr;
+  if (es->volatile_fields) {
+    size_t n = countVolatileValues(es->event.record, es->volatile_fields);
+    eventOccurence.volatile_values = &es->volatile_values[occurence_id * n];
+  }
   return eventOccurence;
 }
 
@@ -207,14 +214,14 @@ AttributeList* ThreadReader::getEventAttributeList(Token event_id, int occurence
 
     while (l->index < occurence_id) { /* move to the next attribute until we reach the needed index */
       summary->attribute_pos += l->struct_size;
+      if (summary->attribute_pos >= summary->attribute_buffer_size)
+        return nullptr;
       l = (AttributeList*)&summary->attribute_buffer[summary->attribute_pos];
     }
     if (l->index == occurence_id) {
       return l;
     }
-    if (l->index > occurence_id) {
-      htf_error("Erro fetching attribute %d. We went too far (cur position: %d) !\n", occurence_id, l->index);
-    }
+    /* This occurence has no attributes, or they were dropped (see HTF_DEGRADATION_DROPPED_ATTRIBUTES). */
   }
   return nullptr;
 };
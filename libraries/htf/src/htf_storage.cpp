@@ -26,6 +26,7 @@
 #include "htf/htf_dbg.h"
 #include "htf/htf_hash.h"
 #include "htf/htf_read.h"
+#include "htf/htf_record.h"
 #include "htf/htf_storage.h"
 
 short STORE_TIMESTAMPS = 1;
@@ -528,6 +529,7 @@ void htf::LinkedVector::writeToFile(FILE* file, bool writeSize = true) const {
 
 htf::LinkedVector::LinkedVector(FILE* file, size_t givenSize) {
   size = givenSize;
+  first = last = nullptr;
   if (size) {
     auto temp = _htf_compress_read(size, file);
     last = new SubVector(size, temp);
@@ -538,6 +540,7 @@ htf::LinkedVector::LinkedVector(FILE* file, size_t givenSize) {
 
 htf::LinkedVector::LinkedVector(FILE* file) {
   _htf_fread(&size, sizeof(size), 1, file);
+  first = last = nullptr;
   if (size) {
     auto temp = _htf_compress_read(size, file);
     last = new SubVector(size, temp);
@@ -588,24 +591,89 @@ static void _htf_read_attribute_values(htf::EventSummary* e, FILE* file) {
   e->attribute_buffer = nullptr;
 
   if (e->attribute_buffer_size > 0) {
-    e->attribute_buffer = new uint8_t[e->attribute_buffer_size];
-    if (e->attribute_buffer == nullptr) {
-      htf_error("Cannot allocate memory\n");
-    }
     if (htf::parameterHandler.getCompressionAlgorithm() != htf::CompressionAlgorithm::None) {
       size_t compressedSize;
       _htf_fread(&compressedSize, sizeof(compressedSize), 1, file);
       byte* compressedArray = new byte[compressedSize];
-      _htf_fread(e->attribute_buffer, compressedSize, 1, file);
+      _htf_fread(compressedArray, compressedSize, 1, file);
       e->attribute_buffer =
         reinterpret_cast<uint8_t*>(_htf_zstd_read(e->attribute_buffer_size, compressedArray, compressedSize));
       delete[] compressedArray;
     } else {
+      e->attribute_buffer = new uint8_t[e->attribute_buffer_size];
+      if (e->attribute_buffer == nullptr) {
+        htf_error("Cannot allocate memory\n");
+      }
       _htf_fread(e->attribute_buffer, e->attribute_buffer_size, 1, file);
     }
   }
 }
 
+/** Stores the values of the volatile fields of an Event. They are identifiers, so they are never compressed lossily. */
+static void _htf_store_volatile_values(htf::EventSummary* e, FILE* file) {
+  _htf_fwrite(&e->volatile_fields, sizeof(e->volatile_fields), 1, file);
+  if (e->volatile_fields == 0)
+    return;
+  size_t size = e->nb_occurences * htf::countVolatileValues(e->event.record, e->volatile_fields) * sizeof(uint64_t);
+  htf_log(htf::DebugLevel::Debug, "\t\tStore %zu bytes of volatile fields\n", size);
+  if (htf::parameterHandler.getCompressionAlgorithm() != htf::CompressionAlgorithm::None) {
+    size_t compressedSize = ZSTD_compressBound(size);
+    byte* compressedArray = new byte[compressedSize];
+    compressedSize = _htf_zstd_compress(e->volatile_values, size, compressedArray, compressedSize);
+    _htf_fwrite(&compressedSize, sizeof(compressedSize), 1, file);
+    _htf_fwrite(compressedArray, compressedSize, 1, file);
+    delete[] compressedArray;
+  } else {
+    _htf_fwrite(e->volatile_values, size, 1, file);
+  }
+}
+
+static void _htf_read_volatile_values(htf::EventSummary* e, FILE* file) {
+  _htf_fread(&e->volatile_fields, sizeof(e->volatile_fields), 1, file);
+  e->volatile_values = nullptr;
+  e->volatile_values_size = 0;
+  if (e->volatile_fields == 0)
+    return;
+  e->volatile_values_size = e->nb_occurences * htf::countVolatileValues(e->event.record, e->volatile_fields);
+  size_t size = e->volatile_values_size * sizeof(uint64_t);
+  if (htf::parameterHandler.getCompressionAlgorithm() != htf::CompressionAlgorithm::None) {
+    size_t compressedSize;
+    _htf_fread(&compressedSize, sizeof(compressedSize), 1, file);
+    byte* compressedArray = new byte[compressedSize];
+    _htf_fread(compressedArray, compressedSize, 1, file);
+    size_t uncompressedSize;
+    e->volatile_values = _htf_zstd_read(uncompressedSize, compressedArray, compressedSize);
+    htf_assert(uncompressedSize == size);
+    delete[] compressedArray;
+  } else {
+    e->volatile_values = new uint64_t[e->volatile_values_size];
+    _htf_fread(e->volatile_values, size, 1, file);
+  }
+}
+
+/** Stores the statistics of the aggregated calls of an Event, if it has some. */
+static void _htf_store_aggregated_calls(htf::EventSummary* e, FILE* file) {
+  uint8_t has_aggregated_calls = e->aggregated_calls != nullptr;
+  _htf_fwrite(&has_aggregated_calls, sizeof(has_aggregated_calls), 1, file);
+  if (has_aggregated_calls) {
+    htf::AggregatedCalls calls = *e->aggregated_calls;
+    // min_duration is HTF_TIMESTAMP_INVALID until the first aggregated call.
+    if (calls.nb_calls == 0)
+      calls.min_duration = 0;
+    _htf_fwrite(&calls, sizeof(calls), 1, file);
+  }
+}
+
+static void _htf_read_aggregated_calls(htf::EventSummary* e, FILE* file) {
+  uint8_t has_aggregated_calls;
+  _htf_fread(&has_aggregated_calls, sizeof(has_aggregated_calls), 1, file);
+  e->aggregated_calls = nullptr;
+  if (has_aggregated_calls) {
+    e->aggregated_calls = new htf::AggregatedCalls;
+    _htf_fread(e->aggregated_calls, sizeof(htf::AggregatedCalls), 1, file);
+  }
+}
+
 static void _htf_store_event(const char* base_dirname, htf::Thread* th, htf::EventSummary* e, htf::Token event) {
   FILE* file = _htf_get_event_file(base_dirname, th, event, "w");
   htf_log(htf::DebugLevel::Debug, "\tStore event %x {.nb_events=%zu}\n", event.id, e->nb_occurences);
@@ -613,6 +681,8 @@ static void _htf_store_event(const char* base_dirname, htf::Thread* th, htf::Eve
   _htf_fwrite(&e->event, sizeof(htf::Event), 1, file);
   _htf_fwrite(&e->nb_occurences, sizeof(e->nb_occurences), 1, file);
   _htf_store_attribute_values(e, file);
+  _htf_store_volatile_values(e, file);
+  _htf_store_aggregated_calls(e, file);
   if (STORE_TIMESTAMPS) {
     e->durations->writeToFile(file, false);
   }
@@ -626,10 +696,19 @@ static void _htf_read_event(const char* base_dirname, htf::Thread* th, htf::Even
   _htf_fread(&e->nb_occurences, sizeof(e->nb_occurences), 1, file);
   htf_log(htf::DebugLevel::Debug, "\tLoad event %x {.nb_events=%zu}\n", event.id, e->nb_occurences);
   _htf_read_attribute_values(e, file);
+  if (th->archive->format_version >= 1) {
+    _htf_read_volatile_values(e, file);
+    _htf_read_aggregated_calls(e, file);
+  } else {
+    e->volatile_fields = 0;
+    e->volatile_values = nullptr;
+    e->volatile_values_size = 0;
+    e->aggregated_calls = nullptr;
+  }
   if (STORE_TIMESTAMPS) {
     e->durations = new htf::LinkedVector(file, e->nb_occurences);
   } else {
-    e->durations->size = 0;
+    e->durations = new htf::LinkedVector();
   }
   fclose(file);
 }
@@ -652,7 +731,7 @@ static void _htf_store_sequence(const char* base_dirname, htf::Thread* th, htf::
   _htf_fwrite(s->tokens.data(), sizeof(s->tokens[0]), s->size(), file);
   if (STORE_HASHING) {
     if (!s->hash) {
-      hash32(s->tokens.data(), s->size(), SEED, &s->hash);
+      s->hash = hashTokens(s->tokens.data(), s->size());
     }
     _htf_fwrite(&s->hash, sizeof(s->hash), 1, file);
   }
@@ -671,8 +750,12 @@ static void _htf_read_sequence(const char* base_dirname, htf::Thread* th, htf::S
   if (STORE_HASHING) {
     uint32_t stored_hash;
     _htf_fread(&stored_hash, sizeof(stored_hash), 1, file);
-    hash32(s->tokens.data(), size, SEED, &s->hash);
-    htf_assert(stored_hash == s->hash);
+    s->hash = hashTokens(s->tokens.data(), size);
+    // Traces of version 0 hashed the sequences with another function: their hash is simply recomputed.
+    if (th->archive->format_version >= 1 && stored_hash != s->hash) {
+      htf_warn("Sequence %x of thread %u: stored hash %x differs from %x, using the recomputed one\n", sequence.id,
+               th->id, stored_hash, s->hash);
+    }
   }
   if (STORE_TIMESTAMPS) {
     s->durations = new htf::LinkedVector(file);
@@ -940,9 +1023,14 @@ static void _htf_store_thread(const char* dir_name, htf::Thread* th) {
   _htf_fwrite(&th->nb_events, sizeof(th->nb_events), 1, token_file);
   _htf_fwrite(&th->nb_sequences, sizeof(th->nb_sequences), 1, token_file);
   _htf_fwrite(&th->nb_loops, sizeof(th->nb_loops), 1, token_file);
+  _htf_fwrite(&th->nb_max_loop_lengths, sizeof(th->nb_max_loop_lengths), 1, token_file);
+  if (th->nb_max_loop_lengths)
+    _htf_fwrite(th->max_loop_lengths, sizeof(size_t), th->nb_max_loop_lengths, token_file);
+  _htf_fwrite(&th->degradations, sizeof(th->degradations), 1, token_file);
+  _htf_fwrite(&th->nb_dropped_attributes, sizeof(th->nb_dropped_attributes), 1, token_file);
+  _htf_fwrite(&th->nb_late_events, sizeof(th->nb_late_events), 1, token_file);
 
   fclose(token_file);
-  htf_finish_timestamp();
 
   for (int i = 0; i < th->nb_events; i++)
     _htf_store_event(dir_name, th, &th->events[i], HTF_EVENT_ID(i));
@@ -959,6 +1047,13 @@ void htf::Thread::finalizeThread() {
   _htf_store_thread(archive->dir_name, this);
 }
 
+/** Converts durations measured in ticks of the given clock to nanoseconds. */
+static void _htf_durations_to_ns(const htf_clock_info_t* clock, htf::LinkedVector* durations) {
+  for (auto& d : *durations) {
+    d = htf_clock_to_ns(clock, d);
+  }
+}
+
 static void _htf_read_thread(htf::Archive* global_archive, htf::Thread* th, htf::ThreadId thread_id) {
   FILE* token_file = _htf_get_thread(global_archive->dir_name, thread_id, "r");
   _htf_fread(&th->id, sizeof(th->id), 1, token_file);
@@ -981,6 +1076,22 @@ static void _htf_read_thread(htf::Archive* global_archive, htf::Thread* th, htf:
   th->nb_allocated_loops = th->nb_loops;
   th->loops = new htf::Loop[th->nb_allocated_loops];
 
+  th->nb_max_loop_lengths = 0;
+  th->max_loop_lengths = nullptr;
+  th->degradations = 0;
+  th->nb_dropped_attributes = 0;
+  th->nb_late_events = 0;
+  if (th->archive->format_version >= 1) {
+    _htf_fread(&th->nb_max_loop_lengths, sizeof(th->nb_max_loop_lengths), 1, token_file);
+    if (th->nb_max_loop_lengths) {
+      th->max_loop_lengths = new size_t[th->nb_max_loop_lengths];
+      _htf_fread(th->max_loop_lengths, sizeof(size_t), th->nb_max_loop_lengths, token_file);
+    }
+    _htf_fread(&th->degradations, sizeof(th->degradations), 1, token_file);
+    _htf_fread(&th->nb_dropped_attributes, sizeof(th->nb_dropped_attributes), 1, token_file);
+    _htf_fread(&th->nb_late_events, sizeof(th->nb_late_events), 1, token_file);
+  }
+
   htf_log(htf::DebugLevel::Verbose, "Reading %d events\n", th->nb_events);
   for (int i = 0; i < th->nb_events; i++)
     _htf_read_event(global_archive->dir_name, th, &th->events[i], HTF_EVENT_ID(i));
@@ -989,6 +1100,22 @@ static void _htf_read_thread(htf::Archive* global_archive, htf::Thread* th, htf:
   for (int i = 0; i < th->nb_sequences; i++)
     _htf_read_sequence(global_archive->dir_name, th, th->sequences[i], HTF_SEQUENCE_ID(i));
 
+  if (STORE_TIMESTAMPS && th->archive->clock.ns_per_tick != 1) {
+    for (int i = 0; i < th->nb_events; i++)
+      _htf_durations_to_ns(&th->archive->clock, th->events[i].durations);
+    for (int i = 0; i < th->nb_sequences; i++)
+      _htf_durations_to_ns(&th->archive->clock, th->sequences[i]->durations);
+  }
+  // The statistics of the aggregated calls are stored even without the timestamps.
+  for (int i = 0; i < th->nb_events; i++) {
+    if (htf::AggregatedCalls* calls = th->events[i].aggregated_calls) {
+      calls->total_duration = htf_clock_to_ns(&th->archive->clock, calls->total_duration);
+      if (calls->min_duration != HTF_TIMESTAMP_INVALID)
+        calls->min_duration = htf_clock_to_ns(&th->archive->clock, calls->min_duration);
+      calls->max_duration = htf_clock_to_ns(&th->archive->clock, calls->max_duration);
+    }
+  }
+
   htf_log(htf::DebugLevel::Verbose, "Reading %d loops\n", th->nb_loops);
   for (int i = 0; i < th->nb_loops; i++)
     _htf_read_loop(global_archive->dir_name, th, &th->loops[i], HTF_LOOP_ID(i));
@@ -1018,6 +1145,10 @@ void htf_storage_finalize(htf::Archive* archive) {
 
   FILE* f = _htf_file_open(fullpath, "w");
   delete[] fullpath;
+  uint32_t magic = HTF_FORMAT_MAGIC;
+  _htf_fwrite(&magic, sizeof(magic), 1, f);
+  archive->format_version = HTF_FORMAT_VERSION;
+  _htf_fwrite(&archive->format_version, sizeof(archive->format_version), 1, f);
   _htf_fwrite(&archive->id, sizeof(htf::LocationGroupId), 1, f);
   size_t size = archive->definitions.strings.size();
   _htf_fwrite(&size, sizeof(size), 1, f);
@@ -1033,6 +1164,8 @@ void htf_storage_finalize(htf::Archive* archive) {
   //  _htf_fwrite(&COMPRESSION_OPTIONS, sizeof(COMPRESSION_OPTIONS), 1, f);
   _htf_fwrite(&STORE_HASHING, sizeof(STORE_HASHING), 1, f);
   _htf_fwrite(&STORE_TIMESTAMPS, sizeof(STORE_TIMESTAMPS), 1, f);
+  archive->clock = htf_get_clock_info();
+  _htf_fwrite(&archive->clock, sizeof(archive->clock), 1, f);
 
   for (int i = 0; i < archive->definitions.strings.size(); i++) {
     _htf_store_string(archive, &archive->definitions.strings[i], i);
@@ -1090,6 +1223,20 @@ static void _htf_read_archive(htf::Archive* global_archive, htf::Archive* archiv
 
   FILE* f = _htf_file_open(archive->fullpath, "r");
 
+  // Traces written before the format was versioned start directly with the id of the archive.
+  uint32_t magic;
+  _htf_fread(&magic, sizeof(magic), 1, f);
+  if (magic == HTF_FORMAT_MAGIC) {
+    _htf_fread(&archive->format_version, sizeof(archive->format_version), 1, f);
+    if (archive->format_version > HTF_FORMAT_VERSION) {
+      htf_error("%s uses version %u of the trace format, but this library only reads up to version %u\n",
+                archive->fullpath, archive->format_version, HTF_FORMAT_VERSION);
+    }
+  } else {
+    archive->format_version = 0;
+    fseek(f, 0, SEEK_SET);
+  }
+
   _htf_fread(&archive->id, sizeof(htf::LocationGroupId), 1, f);
   size_t size;
 
@@ -1112,6 +1259,11 @@ static void _htf_read_archive(htf::Archive* global_archive, htf::Archive* archiv
   //  _htf_fread(&COMPRESSION_OPTIONS, sizeof(COMPRESSION_OPTIONS), 1, f);
   _htf_fread(&STORE_HASHING, sizeof(STORE_HASHING), 1, f);
   _htf_fread(&STORE_TIMESTAMPS, sizeof(STORE_TIMESTAMPS), 1, f);
+  if (archive->format_version >= 1) {
+    _htf_fread(&archive->clock, sizeof(archive->clock), 1, f);
+  } else {
+    archive->clock = {static_cast<uint32_t>(htf::ClockSource::User), 1, 1};
+  }
 
   char* store_timestamps_str = getenv("STORE_TIMESTAMPS");
   if (store_timestamps_str && strcmp(store_timestamps_str, "FALSE") == 0) {
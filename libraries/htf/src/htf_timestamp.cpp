@@ -4,21 +4,117 @@
  */
 
 #include "htf/htf_timestamp.h"
-#include <chrono>
-#include <vector>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include "htf/htf_parameter_handler.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HTF_HAS_TSC
+#endif
 
-using TimePoint = std::chrono::time_point<std::chrono::high_resolution_clock>;
-#define NANOSECONDS(timestamp) std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp).count()
+using namespace htf;
 
-static TimePoint firstTimestamp = {};
-thread_local static std::vector<htf_timestamp_t*> timestampsToDelta = std::vector<htf_timestamp_t*>();
+/** Clock used by htf_get_timestamp. Its timestamps are counted from #origin. */
+struct Clock {
+  ClockSource source;
+  clockid_t clock_id{CLOCK_MONOTONIC};
+  htf_timestamp_t origin{0};
+  htf_clock_info_t info{};
 
-htf_timestamp_t htf_get_timestamp() {
-  TimePoint start = std::chrono::high_resolution_clock::now();
-  if (NANOSECONDS(firstTimestamp.time_since_epoch()) == 0) {
-    firstTimestamp = start;
+  [[nodiscard]] htf_timestamp_t read() const {
+#ifdef HTF_HAS_TSC
+    if (source == ClockSource::TSC)
+      return __rdtsc();
+#endif
+    struct timespec t;
+    clock_gettime(clock_id, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+  }
+  Clock();
+};
+
+#ifdef HTF_HAS_TSC
+/** Returns whether the TSC ticks at a constant rate, whatever the frequency and the power state of the core. */
+static bool _htf_tsc_is_invariant() {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    return false;
+  return edx & (1 << 8);
+}
+
+/** Measures the number of nanoseconds per TSC tick against CLOCK_MONOTONIC_RAW. */
+static double _htf_calibrate_tsc() {
+  struct timespec t1, t2;
+  struct timespec wait = {0, 10000000};
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+  uint64_t tsc1 = __rdtsc();
+  nanosleep(&wait, nullptr);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+  uint64_t tsc2 = __rdtsc();
+  double ns = (t2.tv_sec - t1.tv_sec) * 1e9 + (t2.tv_nsec - t1.tv_nsec);
+  return ns / (double)(tsc2 - tsc1);
+}
+#endif
+
+Clock::Clock() {
+  source = parameterHandler.getClockSource();
+#ifdef HTF_HAS_TSC
+  if (source == ClockSource::TSC && !_htf_tsc_is_invariant()) {
+    htf_warn("The TSC of this CPU is not invariant, using CLOCK_MONOTONIC_RAW instead\n");
+    source = ClockSource::MonotonicRaw;
   }
-  return NANOSECONDS(start - firstTimestamp);
+#else
+  if (source == ClockSource::TSC) {
+    htf_warn("TSC is not available on this architecture, using CLOCK_MONOTONIC_RAW instead\n");
+    source = ClockSource::MonotonicRaw;
+  }
+#endif
+  info.source = static_cast<uint32_t>(source);
+  info.ns_per_tick = 1;
+
+  switch (source) {
+#ifdef HTF_HAS_TSC
+  case ClockSource::TSC:
+    info.ns_per_tick = _htf_calibrate_tsc();
+    info.resolution = info.ns_per_tick;
+    break;
+#endif
+  case ClockSource::MonotonicRaw:
+    clock_id = CLOCK_MONOTONIC_RAW;
+    break;
+  case ClockSource::MonotonicCoarse:
+    clock_id = CLOCK_MONOTONIC_COARSE;
+    break;
+  default:
+    clock_id = CLOCK_MONOTONIC;
+    break;
+  }
+  if (source != ClockSource::TSC) {
+    struct timespec res;
+    clock_getres(clock_id, &res);
+    info.resolution = res.tv_sec * 1e9 + res.tv_nsec;
+  }
+  htf_log(DebugLevel::Verbose, "Using clock %s {.resolution=%lf ns, .ns_per_tick=%lf}\n",
+          algorithmToString(source).c_str(), info.resolution, info.ns_per_tick);
+  origin = read();
+}
+
+/** Whether htf_get_timestamp was called at least once. */
+static std::atomic<bool> clock_used{false};
+
+static const Clock& _htf_get_clock() {
+  static const Clock clock;
+  return clock;
+}
+
+htf_timestamp_t htf_get_timestamp() {
+  const Clock& clock = _htf_get_clock();
+  if (!clock_used.load(std::memory_order_relaxed))
+    clock_used.store(true, std::memory_order_relaxed);
+  return clock.read() - clock.origin;
 }
 
 htf_timestamp_t htf_timestamp(htf_timestamp_t t) {
@@ -27,30 +123,50 @@ htf_timestamp_t htf_timestamp(htf_timestamp_t t) {
   return t;
 }
 
-void htf_delta_timestamp(htf_timestamp_t* t) {
-  if (!timestampsToDelta.empty()) {
-    htf_timestamp_t startingTimestamp = *timestampsToDelta.front();
-    htf_timestamp_t startingDuration = 0;
-    for (auto& timestamp : timestampsToDelta) {
-      if (!startingDuration) {
-        *timestamp = *t - *timestamp;
-        startingDuration = *timestamp;
-      } else {
-        *timestamp += startingDuration;
-        *timestamp -= startingTimestamp;
-      }
-    }
-    timestampsToDelta.clear();
-  }
-  timestampsToDelta.push_back(t);
+/** Clock given to htf_set_clock_info. */
+static htf_clock_info_t forwarded_clock;
+/** Whether htf_set_clock_info was called. */
+static std::atomic<bool> clock_forwarded{false};
+
+void htf_set_clock_info(const htf_clock_info_t* clock) {
+  forwarded_clock = *clock;
+  clock_forwarded.store(true, std::memory_order_release);
 }
 
-void htf_add_timestamp_to_delta(htf_timestamp_t* t) {
-  timestampsToDelta.push_back(t);
+htf_clock_info_t htf_get_clock_info() {
+  if (clock_forwarded.load(std::memory_order_acquire))
+    return forwarded_clock;
+  if (clock_used.load(std::memory_order_relaxed))
+    return _htf_get_clock().info;
+  htf_clock_info_t user_clock = {static_cast<uint32_t>(ClockSource::User), 1, 1};
+  return user_clock;
+}
+
+htf_timestamp_t htf_clock_to_ns(const htf_clock_info_t* clock, htf_timestamp_t ticks) {
+  if (clock->ns_per_tick == 1)
+    return ticks;
+  return std::llround(ticks * clock->ns_per_tick);
+}
+
+void htf::TimestampBuffer::resolve() {
+  if (timestamps.empty())
+    return;
+  size_t last = timestamps.size() - 1;
+  for (auto& p : pending) {
+    *p.slot = timestamps[std::min(p.last_event + 1, last)] - *p.slot;
+  }
+  pending.clear();
+
+  htf_timestamp_t* ts = timestamps.data();
+  for (size_t i = 0; i < last; i++) {
+    ts[i] = ts[i + 1] - ts[i];
+  }
+  ts[last] = 0;
 }
 
-void htf_finish_timestamp() {
-  *timestampsToDelta.front() = 0;
+void htf::TimestampBuffer::clear() {
+  std::vector<htf_timestamp_t>().swap(timestamps);
+  std::vector<PendingDuration>().swap(pending);
 }
 
 /* -*-
@@ -8,16 +8,50 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 
 #include "htf/htf_parameter_handler.h"
 #include "htf/htf.h"
 #include "htf/htf_archive.h"
+#include "htf/htf_async.h"
+#include "htf/htf_collector.h"
+#include "htf/htf_filter.h"
 #include "htf/htf_hash.h"
+#include "htf/htf_pool.h"
+#include "htf/htf_record.h"
 #include "htf/htf_storage.h"
 #include "htf/htf_timestamp.h"
 #include "htf/htf_write.h"
 thread_local int htf_recursion_shield = 0;
 
+/** Smallest maximum loop length chosen by the adaptive loop length. */
+#define ADAPTIVE_LOOP_LENGTH_MIN 8
+/** Largest maximum loop length chosen by the adaptive loop length. */
+#define ADAPTIVE_LOOP_LENGTH_MAX 4096
+/** Number of tokens that the failed searches of a level may examine, per unit of its maximum loop length,
+ * before that maximum loop length shrinks. */
+#define ADAPTIVE_LOOP_LENGTH_BUDGET 1024
+/** Smallest number of AsyncEvents in the ring of a stream, see htf_write_streams_open. */
+#define STREAM_ASYNC_RING_SIZE_MIN 1024
+/** Smallest number of bytes of the collector ring of a stream, see htf_write_streams_open. */
+#define STREAM_COLLECTOR_RING_SIZE_MIN (256 * 1024)
+
+/** Returns how an Event with the given record changes the callstack. */
+static enum htf::EventType _htf_event_type(enum htf::Record record) {
+  switch (record) {
+  case htf::HTF_EVENT_ENTER:
+  case htf::HTF_EVENT_THREAD_BEGIN:
+  case htf::HTF_EVENT_THREAD_TEAM_BEGIN:
+    return htf::HTF_BLOCK_START;
+  case htf::HTF_EVENT_LEAVE:
+  case htf::HTF_EVENT_THREAD_END:
+  case htf::HTF_EVENT_THREAD_TEAM_END:
+    return htf::HTF_BLOCK_END;
+  default:
+    return htf::HTF_SINGLETON;
+  }
+}
+
 namespace htf {
 Token Thread::getSequenceId(htf::Sequence* sequence) {
   return getSequenceIdFromArray(sequence->tokens.data(), sequence->size());
@@ -31,63 +65,134 @@ static inline bool _htf_arrays_equal(Token* array1, size_t size1, Token* array2,
   return memcmp(array1, array2, sizeof(Token) * size1) == 0;
 }
 
+/**
+ * Returns the first slot of Thread::sequence_index where a sequence with that hash and size may be stored.
+ */
+static inline size_t _htf_sequence_slot(uint32_t hash, size_t size, size_t nb_slots) {
+  return (hash ^ (uint32_t)(size * 0x9e3779b1u)) & (nb_slots - 1);
+}
+
+/**
+ * Rebuilds the sequence index of a Thread with enough slots for one more sequence.
+ *
+ * The index is kept at most half full, so that probe sequences remain short.
+ * Sequence 0 is the main sequence of the thread: it is never looked up, and is thus not indexed.
+ */
+static void _htf_grow_sequence_index(Thread* thread) {
+  unsigned nb_slots = thread->sequence_index_size ? thread->sequence_index_size : 16;
+  while (nb_slots < 2 * (thread->nb_sequences + 1))
+    nb_slots *= 2;
+  htf_log(DebugLevel::Debug, "Resizing sequence index of thread %p to %u slots\n", thread, nb_slots);
+
+  delete[] thread->sequence_index;
+  thread->sequence_index = new TokenId[nb_slots];
+  thread->sequence_index_size = nb_slots;
+  std::fill_n(thread->sequence_index, nb_slots, HTF_TOKEN_ID_INVALID);
+
+  for (TokenId i = 1; i < thread->nb_sequences; i++) {
+    Sequence* s = thread->sequences[i];
+    size_t slot = _htf_sequence_slot(s->hash, s->size(), nb_slots);
+    while (thread->sequence_index[slot] != HTF_TOKEN_ID_INVALID)
+      slot = (slot + 1) & (nb_slots - 1);
+    thread->sequence_index[slot] = i;
+  }
+}
+
 Token Thread::getSequenceIdFromArray(htf::Token* token_array, size_t array_len) {
-  uint32_t hash;
-  hash32(token_array, array_len, SEED, &hash);
-  htf_log(DebugLevel::Debug, "Searching for sequence {.size=%zu, .hash=%x}\n", array_len, hash);
+  return getSequenceIdFromArray(token_array, array_len, hashTokens(token_array, array_len));
+}
 
-  for (unsigned i = 1; i < nb_sequences; i++) {
-    if (sequences[i]->hash == hash) {
-      if (_htf_arrays_equal(token_array, array_len, sequences[i]->tokens.data(), sequences[i]->size())) {
-        htf_log(DebugLevel::Debug, "\t found with id=%u\n", i);
-        return HTF_SEQUENCE_ID(i);
-      } else {
-        htf_warn("Found two sequences with the same hash\n");
-      }
+/**
+ * Searches Thread::sequence_index for the sequence made of the given array of tokens.
+ * @param slot Set to the slot of that sequence if it is found, or to the free slot where it would go.
+ * @returns The id of the sequence, or HTF_TOKEN_ID_INVALID if it was never registered.
+ */
+static TokenId _htf_probe_sequence(const Thread* thread,
+                                   const Token* token_array,
+                                   size_t array_len,
+                                   uint32_t hash,
+                                   size_t* slot) {
+  size_t nb_slots = thread->sequence_index_size;
+  for (*slot = _htf_sequence_slot(hash, array_len, nb_slots); thread->sequence_index[*slot] != HTF_TOKEN_ID_INVALID;
+       *slot = (*slot + 1) & (nb_slots - 1)) {
+    TokenId i = thread->sequence_index[*slot];
+    Sequence* s = thread->sequences[i];
+    if (s->hash == hash) {
+      if (_htf_arrays_equal((Token*)token_array, array_len, s->tokens.data(), s->size()))
+        return i;
     }
   }
+  return HTF_TOKEN_ID_INVALID;
+}
+
+Token Thread::getSequenceIdFromArray(htf::Token* token_array, size_t array_len, uint32_t hash) {
+  htf_log(DebugLevel::Debug, "Searching for sequence {.size=%zu, .hash=%x}\n", array_len, hash);
+
+  /* Make sure there is room for a new sequence before probing, so that the free slot we end up on stays valid. */
+  if (2 * (nb_sequences + 1) > sequence_index_size) {
+    _htf_grow_sequence_index(this);
+  }
+
+  size_t slot;
+  TokenId found = _htf_probe_sequence(this, token_array, array_len, hash, &slot);
+  if (found != HTF_TOKEN_ID_INVALID) {
+    htf_log(DebugLevel::Debug, "\t found with id=%u\n", found);
+    return HTF_SEQUENCE_ID(found);
+  }
 
   if (nb_sequences >= nb_allocated_sequences) {
-    htf_warn("Doubling mem space of sequence for thread trace %p\n", this);
+    htf_log(DebugLevel::Debug, "Doubling mem space of sequence for thread trace %p\n", this);
     DOUBLE_MEMORY_SPACE(sequences, nb_allocated_sequences, Sequence*);
-    for (uint i = nb_allocated_sequences / 2; i < nb_allocated_sequences; i++) {
-      sequences[i] = new Sequence;
-    }
   }
 
   size_t index = nb_sequences++;
   Token sid = HTF_SEQUENCE_ID(index);
   htf_log(DebugLevel::Debug, "\tSequence not found. Adding it with id=S%zx\n", index);
 
-  Sequence* s = getSequence(sid);
+  Sequence* s = newSequence();
+  sequences[index] = s;
   s->tokens.resize(array_len);
   memcpy(s->tokens.data(), token_array, sizeof(Token) * array_len);
   s->hash = hash;
+  sequence_index[slot] = index;
 
   return sid;
 }
 
 Loop* ThreadWriter::createLoop(int start_index, int loop_len) {
   if (thread_trace.nb_loops >= thread_trace.nb_allocated_loops) {
-    htf_warn("Doubling mem space of loops for thread writer %p's thread trace, cur=%d\n", this,
-             thread_trace.nb_allocated_loops);
+    htf_log(DebugLevel::Debug, "Doubling mem space of loops for thread writer %p's thread trace, cur=%d\n", this,
+            thread_trace.nb_allocated_loops);
     DOUBLE_MEMORY_SPACE(thread_trace.loops, thread_trace.nb_allocated_loops, Loop);
   }
 
   auto* cur_seq = getCurrentSequence();
-  Token sid = thread_trace.getSequenceIdFromArray(&cur_seq->tokens[start_index], loop_len);
-
-  int index = -1;
-  for (int i = 0; i < thread_trace.nb_loops; i++) {
-    if (thread_trace.loops[i].repeated_token.id == sid.id) {
-      index = i;
-      htf_log(DebugLevel::Debug, "\tLoop already exists: id=L%x containing S%x\n", index, sid.id);
-      break;
-    }
+  uint32_t hash = hashFold(getCurrentFrame().hash(start_index, loop_len));
+  Token sid = thread_trace.getSequenceIdFromArray(&cur_seq->tokens[start_index], loop_len, hash);
+
+  if (sid.id >= thread_trace.loop_index_size) {
+    unsigned new_size = thread_trace.loop_index_size ? thread_trace.loop_index_size : NB_LOOP_DEFAULT;
+    while (new_size <= sid.id)
+      new_size *= 2;
+    thread_trace.loop_index =
+      (TokenId*)htf_realloc(thread_trace.loop_index, thread_trace.loop_index_size, new_size, sizeof(TokenId));
+    std::fill(&thread_trace.loop_index[thread_trace.loop_index_size], &thread_trace.loop_index[new_size],
+              HTF_TOKEN_ID_INVALID);
+    thread_trace.loop_index_size = new_size;
   }
-  if (index == -1) {
+
+  TokenId index = thread_trace.loop_index[sid.id];
+  if (index != HTF_TOKEN_ID_INVALID) {
+    htf_log(DebugLevel::Debug, "\tLoop already exists: id=L%x containing S%x\n", index, sid.id);
+  } else {
     index = thread_trace.nb_loops++;
+    thread_trace.loop_index[sid.id] = index;
     htf_log(DebugLevel::Debug, "\tLoop not found. Adding it with id=L%x containing S%x\n", index, sid.id);
+    if (loop_lengths) {
+      auto position = std::lower_bound(loop_lengths->begin(), loop_lengths->end(), (size_t)loop_len);
+      if (position == loop_lengths->end() || *position != (size_t)loop_len)
+        loop_lengths->insert(position, loop_len);
+    }
   }
 
   Loop* l = &thread_trace.loops[index];
@@ -98,23 +203,49 @@ Loop* ThreadWriter::createLoop(int start_index, int loop_len) {
 }
 
 void ThreadWriter::storeTimestamp(EventSummary* es, htf_timestamp_t ts) {
-  htf_delta_timestamp(&es->durations->add(ts));
+  // EventSummaries that were not created by getEventId (eg. through htf_store_event) have no durations yet.
+  if (!es->durations)
+    es->durations = thread_trace.newDurations();
+  es->durations->add(timestamps->add(ts));
+}
+
+void ThreadWriter::storeVolatileValues(EventSummary* es, const uint64_t* values) {
+  size_t n = countVolatileValues(es->event.record, es->volatile_fields);
+  size_t pos = (es->nb_occurences - 1) * n;
+  if (pos + n > es->volatile_values_size) {
+    size_t new_size = es->volatile_values_size ? es->volatile_values_size * 2 : DEFAULT_VECTOR_SIZE * n;
+    es->volatile_values = arena->growArray(es->volatile_values, es->volatile_values_size, new_size);
+    es->volatile_values_size = new_size;
+  }
+  if (values)
+    memcpy(&es->volatile_values[pos], values, n * sizeof(uint64_t));
+  else
+    memset(&es->volatile_values[pos], 0, n * sizeof(uint64_t));
 }
 
 void ThreadWriter::storeAttributeList(htf::EventSummary* es,
                                       struct htf::AttributeList* attribute_list,
                                       size_t occurence_index) {
   attribute_list->index = occurence_index;
+  size_t max_size = parameterHandler.getMaxAttributeBufferSize();
+  if (max_size && es->attribute_pos + attribute_list->struct_size >= max_size) {
+    thread_trace.nb_dropped_attributes++;
+    degrade(HTF_DEGRADATION_DROPPED_ATTRIBUTES);
+    return;
+  }
   if (es->attribute_pos + attribute_list->struct_size >= es->attribute_buffer_size) {
+    size_t new_size;
     if (es->attribute_buffer_size == 0) {
       htf_warn("Allocating attribute memory for event %u\n", es->id);
-      es->attribute_buffer_size = NB_ATTRIBUTE_DEFAULT * sizeof(struct htf::AttributeList);
-      es->attribute_buffer = new uint8_t[es->attribute_buffer_size];
-      htf_assert(es->attribute_buffer != NULL);
+      new_size = NB_ATTRIBUTE_DEFAULT * sizeof(struct htf::AttributeList);
     } else {
-      htf_warn("Doubling mem space of attributes for event %u\n", es->id);
-      DOUBLE_MEMORY_SPACE(es->attribute_buffer, es->attribute_buffer_size, uint8_t);
+      htf_log(DebugLevel::Debug, "Doubling mem space of attributes for event %u\n", es->id);
+      new_size = es->attribute_buffer_size * 2;
     }
+    if (max_size)
+      new_size = std::min<size_t>(new_size, max_size);
+    es->attribute_buffer = arena->growArray(es->attribute_buffer, es->attribute_buffer_size, new_size);
+    es->attribute_buffer_size = new_size;
     htf_assert(es->attribute_pos + attribute_list->struct_size < es->attribute_buffer_size);
   }
 
@@ -125,11 +256,64 @@ void ThreadWriter::storeAttributeList(htf::EventSummary* es,
           attribute_list->struct_size, attribute_list->nb_values);
 }
 
-void ThreadWriter::storeToken(htf::Sequence* seq, htf::Token t) {
-  htf_log(DebugLevel::Debug, "store_token: (%c%x) in %p (size: %zu)\n", HTF_TOKEN_TYPE_C(t), t.id, seq,
-          seq->size() + 1);
-  seq->tokens.push_back(t);
+void ThreadWriter::degrade(enum Degradation degradation) {
+  if (thread_trace.degradations & degradation)
+    return;
+  thread_trace.degradations |= degradation;
+  if (degradation == HTF_DEGRADATION_FLAT_SEQUENCES)
+    htf_warn("Thread %u has %u Sequences: its next calls are stored as a flat stream of Events\n", thread_trace.id,
+             thread_trace.nb_sequences);
+  else if (degradation == HTF_DEGRADATION_DROPPED_ATTRIBUTES)
+    htf_warn("Thread %u: the attributes of an Event exceed %zu bytes, the next ones are dropped\n", thread_trace.id,
+             (size_t)parameterHandler.getMaxAttributeBufferSize());
+}
+
+void CallstackFrame::push(htf::Token t, htf_timestamp_t start) {
+  size_t position = prefix_hashes.size() - 1;
+  prefix_hashes.push_back(hashAppend(prefix_hashes.back(), t));
+  token_starts.push_back(start);
+  if (index_positions) {
+    token_positions[positionKey(t)].push_back(position);
+    if (t.type == TypeLoop)
+      loop_positions.push_back(position);
+  }
+}
+
+void CallstackFrame::truncate(const std::vector<Token>& tokens, size_t size) {
+  if (index_positions) {
+    for (size_t position = tokens.size(); position-- > size;) {
+      auto& positions = token_positions[positionKey(tokens[position])];
+      htf_assert(positions.back() == position);
+      positions.pop_back();
+    }
+    while (!loop_positions.empty() && loop_positions.back() >= size)
+      loop_positions.pop_back();
+  }
+  prefix_hashes.resize(size + 1);
+  token_starts.resize(size);
+}
+
+void ThreadWriter::pushToken(htf::Token t, htf_timestamp_t start) {
+  getCurrentSequence()->tokens.push_back(t);
+  getCurrentFrame().push(t, start);
+}
+
+void ThreadWriter::truncateCurrentSequence(size_t size) {
+  getCurrentFrame().truncate(getCurrentSequence()->tokens, size);
+  getCurrentSequence()->tokens.resize(size);
+}
+
+void ThreadWriter::storeToken(htf::Token t, htf_timestamp_t start) {
+  htf_log(DebugLevel::Debug, "store_token: (%c%x) in %p (size: %zu)\n", HTF_TOKEN_TYPE_C(t), t.id,
+          getCurrentSequence(), getCurrentSequence()->size() + 1);
+  pushToken(t, start);
+  if (thread_trace.degradations & HTF_DEGRADATION_FLAT_SEQUENCES)
+    return;
+  size_t size = getCurrentSequence()->size();
   findLoop();
+  // If no Loop was found, the last tokens may still be an iteration of a known Loop.
+  if (loop_lengths && getCurrentSequence()->size() == size && findSingleIteration())
+    findLoop();
 }
 
 /**
@@ -159,20 +343,69 @@ void ThreadWriter::replaceTokensInLoop(int loop_len, size_t index_first_iteratio
   }
 
   Loop* loop = createLoop(index_first_iteration, loop_len);
-  Sequence* cur_seq = getCurrentSequence();
-
-  // We need to go back in the current sequence in order to correctly calculate our durations
   Sequence* loop_seq = thread_trace.getSequence(loop->repeated_token);
 
-  loop_seq->durations->add(thread_trace.getSequenceDuration(&cur_seq->tokens[index_first_iteration], loop_len));
-  loop_seq->durations->add(thread_trace.getSequenceDuration(&cur_seq->tokens[index_second_iteration], loop_len));
+  // The first iteration ends when the second one starts, and the second one ends with the next event.
+  const CallstackFrame& frame = getCurrentFrame();
+  htf_timestamp_t first_start = frame.token_starts[index_first_iteration];
+  htf_timestamp_t second_start = frame.token_starts[index_second_iteration];
+  loop_seq->durations->add(second_start - first_start);
+  timestamps->addPending(&loop_seq->durations->add(second_start));
 
-  htf_add_timestamp_to_delta(&loop_seq->durations->back());
+  truncateCurrentSequence(index_first_iteration);
+  pushToken(loop->self_id, first_start);
+
+  loop->addIteration();
+}
+
+void ThreadWriter::replaceTokensInSingleIteration(Loop* loop, size_t index_iteration) {
+  Sequence* loop_seq = thread_trace.getSequence(loop->repeated_token);
+  htf_log(DebugLevel::Debug, "Last tokens are a single iteration of L%x aka S%x\n", loop->self_id.id,
+          loop->repeated_token.id);
+
+  htf_timestamp_t start = getCurrentFrame().token_starts[index_iteration];
+  loop->nb_iterations.push_back(1);
+  // The iteration ends with the next event.
+  timestamps->addPending(&loop_seq->durations->add(start));
+  truncateCurrentSequence(index_iteration);
+  pushToken(loop->self_id, start);
+}
+
+bool ThreadWriter::findSingleIteration() {
+  Sequence* cur_seq = getCurrentSequence();
+  const CallstackFrame& frame = getCurrentFrame();
+  size_t size = cur_seq->size();
+  for (size_t loop_len : *loop_lengths) {
+    if (loop_len > size)
+      break;
+    size_t start = size - loop_len;
+    size_t slot;
+    TokenId sid = _htf_probe_sequence(&thread_trace, &cur_seq->tokens[start], loop_len,
+                                      hashFold(frame.hash(start, loop_len)), &slot);
+    if (sid == HTF_TOKEN_ID_INVALID || sid >= thread_trace.loop_index_size)
+      continue;
+    TokenId loop_id = thread_trace.loop_index[sid];
+    if (loop_id == HTF_TOKEN_ID_INVALID)
+      continue;
+    Loop* loop = &thread_trace.loops[loop_id];
+    // Right after an occurence of the same Loop, these tokens were left out of it by the loop-finding algorithm.
+    if (start > 0 && cur_seq->tokens[start - 1] == loop->self_id)
+      continue;
+    replaceTokensInSingleIteration(loop, start);
+    return true;
+  }
+  return false;
+}
 
-  cur_seq->tokens.resize(index_first_iteration);
-  cur_seq->tokens.push_back(loop->self_id);
+void ThreadWriter::addLoopIteration(Loop* loop, size_t index_iteration) {
+  Sequence* loop_seq = thread_trace.getSequence(loop->repeated_token);
+  htf_log(DebugLevel::Debug, "Last tokens were a sequence from L%x aka S%x\n", loop->self_id.id,
+          loop->repeated_token.id);
 
   loop->addIteration();
+  // The iteration ends with the next event.
+  timestamps->addPending(&loop_seq->durations->add(getCurrentFrame().token_starts[index_iteration]));
+  truncateCurrentSequence(index_iteration);
 }
 
 /**
@@ -205,12 +438,7 @@ void ThreadWriter::findLoopBasic(size_t maxLoopLength) {
       if (_htf_arrays_equal(&currentSequence->tokens[s1Start], loopLength, seq->tokens.data(), seq->size())) {
         // The current sequence is just another iteration of the loop
         // remove the sequence, and increment the iteration count
-        htf_log(DebugLevel::Debug, "Last tokens were a sequence from L%x aka S%x\n", loop->self_id.id,
-                loop->repeated_token.id);
-        loop->addIteration();
-        htf_timestamp_t ts = thread_trace.getSequenceDuration(&currentSequence->tokens[s1Start], loopLength);
-        htf_add_timestamp_to_delta(&seq->durations->add(ts));
-        currentSequence->tokens.resize(s1Start);
+        addLoopIteration(loop, s1Start);
         return;
       }
     }
@@ -242,24 +470,14 @@ void ThreadWriter::findLoopBasic(size_t maxLoopLength) {
  *
  * The idea is that since we always search for a Loop who will end on our last Token,
  * We only need to start searching arrays who end by that token.
- * We thus start by filtering the indexes of the correct tokens, and then we start searching for loops, using those
- * indexes.
+ * The indexes of the correct tokens (and of the Loop tokens) are maintained by the CallstackFrame
+ * as tokens are pushed and removed, so we only visit those indexes when searching for loops.
  */
 void ThreadWriter::findLoopFilter() {
-  auto endingIndexes = std::vector<size_t>();
-  auto loopIndexes = std::vector<size_t>();
-  size_t i = 0;
   Sequence* currentSequence = getCurrentSequence();
+  const CallstackFrame& frame = getCurrentFrame();
   size_t curIndex = currentSequence->size() - 1;
-  for (auto token : currentSequence->tokens) {
-    if (token == currentSequence->tokens.back()) {
-      endingIndexes.push_back(i);
-    }
-    if (token.type == TypeLoop) {
-      loopIndexes.push_back(i);
-    }
-    i++;
-  }
+  const auto& endingIndexes = frame.token_positions.at(CallstackFrame::positionKey(currentSequence->tokens.back()));
   for (auto endingIndex : endingIndexes) {
     size_t loopLength = curIndex - endingIndex;
     // If the loop can't exist, we skip it
@@ -273,28 +491,80 @@ void ThreadWriter::findLoopFilter() {
         thread_trace.printTokenArray(currentSequence->tokens.data(), endingIndex + 1 - loopLength, loopLength);
         printf("\n");
       }
+      // This changes the current sequence (and the indexes), so we stop here.
       replaceTokensInLoop(loopLength, endingIndex + 1, endingIndex + 1 - loopLength);
+      return;
     }
   }
 
-  for (auto loopIndex : loopIndexes) {
+  for (auto loopIndex : frame.loop_positions) {
     Token token = currentSequence->tokens[loopIndex];
     size_t loopLength = curIndex - loopIndex;
     auto* loop = thread_trace.getLoop(token);
     auto* sequence = thread_trace.getSequence(loop->repeated_token);
     if (_htf_arrays_equal(&currentSequence->tokens[loopIndex + 1], loopLength, sequence->tokens.data(),
                           sequence->size())) {
-      htf_log(DebugLevel::Debug, "Last tokens were a sequence from L%x aka S%x\n", loop->self_id.id,
-              loop->repeated_token.id);
-      loop->addIteration();
-      htf_timestamp_t ts = thread_trace.getSequenceDuration(&currentSequence->tokens[loopIndex + 1], loopLength);
-      htf_add_timestamp_to_delta(&sequence->durations->add(ts));
-      currentSequence->tokens.resize(loopIndex + 1);
+      addLoopIteration(loop, loopIndex + 1);
       return;
     }
   }
 }
 
+/**
+ * Finds a Loop in the current Sequence by comparing hashes instead of arrays of tokens.
+ *
+ * This searches for the same patterns as findLoopBasic, but the hash of any array of tokens that ends
+ * the current Sequence is derived in constant time from the prefix hashes kept in the CallstackFrame.
+ * The arrays are only compared token by token to confirm that two equal hashes come from equal arrays.
+ * @param maxLoopLength The maximum loop length that we try to find.
+ */
+void ThreadWriter::findLoopRollingHash(size_t maxLoopLength) {
+  Sequence* currentSequence = getCurrentSequence();
+  const CallstackFrame& frame = getCurrentFrame();
+  const Token* tokens = currentSequence->tokens.data();
+  size_t size = currentSequence->size();
+  Token lastToken = tokens[size - 1];
+  for (size_t loopLength = 1; loopLength < maxLoopLength && loopLength < size; loopLength++) {
+    size_t s1Start = size - loopLength;
+    // A loop can only be found if the token before the last loopLength tokens is either a Loop (that
+    // may be extended) or the last token (the end of a previous iteration). Skip the others cheaply.
+    Token previousToken = tokens[s1Start - 1];
+    if (previousToken.type != TypeLoop && !(previousToken == lastToken))
+      continue;
+
+    uint64_t power = hashPower(loopLength);
+    uint64_t s1Hash = frame.prefix_hashes[size] - frame.prefix_hashes[s1Start] * power;
+
+    // First, check if the last tokens are another iteration of the loop that ends at s1Start
+    if (previousToken.type == TypeLoop) {
+      Loop* loop = thread_trace.getLoop(previousToken);
+      Sequence* seq = thread_trace.getSequence(loop->repeated_token);
+      if (seq->size() == loopLength && seq->hash == hashFold(s1Hash) &&
+          _htf_arrays_equal(&currentSequence->tokens[s1Start], loopLength, seq->tokens.data(), seq->size())) {
+        addLoopIteration(loop, s1Start);
+        return;
+      }
+    }
+
+    // Then, check if the last tokens are repeated just before them.
+    if (size >= 2 * loopLength && previousToken == lastToken) {
+      size_t s2Start = size - 2 * loopLength;
+      uint64_t s2Hash = frame.prefix_hashes[s1Start] - frame.prefix_hashes[s2Start] * power;
+      if (s1Hash == s2Hash && _htf_arrays_equal(&currentSequence->tokens[s1Start], loopLength,
+                                                &currentSequence->tokens[s2Start], loopLength)) {
+        if (debugLevel >= DebugLevel::Debug) {
+          printf("Found a loop of len %zu:\n", loopLength);
+          thread_trace.printTokenArray(tokens, s1Start, loopLength);
+          thread_trace.printTokenArray(tokens, s2Start, loopLength);
+          printf("\n");
+        }
+        replaceTokensInLoop(loopLength, s1Start, s2Start);
+        return;
+      }
+    }
+  }
+}
+
 void ThreadWriter::findLoop() {
   if (parameterHandler.getLoopFindingAlgorithm() == LoopFindingAlgorithm::None) {
     return;
@@ -309,7 +579,7 @@ void ThreadWriter::findLoop() {
   case LoopFindingAlgorithm::Basic:
   case LoopFindingAlgorithm::BasicTruncated: {
     size_t maxLoopLength = (parameterHandler.getLoopFindingAlgorithm() == LoopFindingAlgorithm::BasicTruncated)
-                             ? parameterHandler.getMaxLoopLength()
+                             ? getMaxLoopLength()
                              : SIZE_MAX;
     if (debugLevel >= DebugLevel::Debug) {
       printf("Find loops using Basic Algorithm:\n");
@@ -323,16 +593,71 @@ void ThreadWriter::findLoop() {
     findLoopFilter();
     break;
   }
+  case LoopFindingAlgorithm::RollingHash: {
+    findLoopRollingHash(getMaxLoopLength());
+    break;
+  }
+  }
+  if (parameterHandler.getAdaptiveLoopLength())
+    adaptMaxLoopLength(currentIndex + 1);
+}
+
+size_t ThreadWriter::getMaxLoopLength() const {
+  if (parameterHandler.getAdaptiveLoopLength())
+    return getCurrentFrame().max_loop_length;
+  return parameterHandler.getMaxLoopLength();
+}
+
+void ThreadWriter::adaptMaxLoopLength(size_t searched_size) {
+  CallstackFrame& frame = getCurrentFrame();
+  Sequence* currentSequence = getCurrentSequence();
+  size_t old_length = frame.max_loop_length;
+  if (currentSequence->size() != searched_size) {
+    // A Loop was found: it is the last token of the Sequence.
+    Loop* loop = thread_trace.getLoop(currentSequence->tokens.back());
+    size_t loop_length = thread_trace.getSequence(loop->repeated_token)->size();
+    frame.longest_loop = std::max(frame.longest_loop, loop_length);
+    frame.failed_search_cost = 0;
+    // Loops this long are common here: longer ones may be missed.
+    if (2 * loop_length > frame.max_loop_length)
+      frame.max_loop_length = std::min(2 * frame.max_loop_length, (size_t)ADAPTIVE_LOOP_LENGTH_MAX);
+  } else {
+    frame.failed_search_cost += std::min(frame.max_loop_length, searched_size);
+    if (frame.failed_search_cost < ADAPTIVE_LOOP_LENGTH_BUDGET * frame.max_loop_length)
+      return;
+    // The searches mostly fail: only search for Loops up to twice as long as the ones found so far.
+    frame.failed_search_cost = 0;
+    size_t needed_length = std::max(2 * frame.longest_loop, (size_t)ADAPTIVE_LOOP_LENGTH_MIN);
+    if (needed_length < frame.max_loop_length)
+      frame.max_loop_length = std::max(needed_length, frame.max_loop_length / 2);
   }
+  if (frame.max_loop_length != old_length)
+    htf_log(DebugLevel::Debug, "Thread %u: the maximum loop length at depth %d goes from %zu to %zu\n",
+            thread_trace.id, cur_depth, old_length, frame.max_loop_length);
 }
 
 void ThreadWriter::recordEnterFunction() {
   cur_depth++;
   if (cur_depth >= max_depth) {
-    htf_error("Depth = %d >= max_depth (%d) \n", cur_depth, max_depth);
+    htf_log(DebugLevel::Debug, "Doubling the callstack depth of thread writer %p to %d\n", this, max_depth * 2);
+    og_seq = (Sequence**)htf_realloc(og_seq, max_depth, max_depth * 2, sizeof(Sequence*));
+    frames = (CallstackFrame**)htf_realloc(frames, max_depth, max_depth * 2, sizeof(CallstackFrame*));
+    max_depth *= 2;
+  }
+  if (!frames[cur_depth]) {
+    createCallstackLevel(cur_depth);
   }
 }
 
+void ThreadWriter::createCallstackLevel(int depth) {
+  if (!og_seq[depth])
+    og_seq[depth] = thread_trace.newSequence();
+  frames[depth] = arena->create<CallstackFrame>();
+  frames[depth]->index_positions = parameterHandler.getLoopFindingAlgorithm() == LoopFindingAlgorithm::Filter;
+  if (parameterHandler.getAdaptiveLoopLength())
+    frames[depth]->max_loop_length = parameterHandler.getMaxLoopLength();
+}
+
 void ThreadWriter::recordExitFunction() {
   Sequence* cur_seq = getCurrentSequence();
 
@@ -346,7 +671,11 @@ void ThreadWriter::recordExitFunction() {
              first_token.id, last_token.type, last_token.id);
   }
 
-  if (first_token.type == TypeEvent) {
+  // The calls that started or ended while the measurement was off have no Enter or no Leave.
+  bool measurement_gap = first_token.type == TypeEvent && last_token.type == TypeEvent &&
+                         (thread_trace.getEvent(first_token)->record == HTF_EVENT_MEASUREMENT_ON_OFF ||
+                          thread_trace.getEvent(last_token)->record == HTF_EVENT_MEASUREMENT_ON_OFF);
+  if (first_token.type == TypeEvent && last_token.type == TypeEvent && !measurement_gap) {
     Event* first_event = thread_trace.getEvent(first_token);
     Event* last_event = thread_trace.getEvent(last_token);
 
@@ -396,12 +725,28 @@ void ThreadWriter::recordExitFunction() {
   }
 #endif
 
-  Token seq_id = thread_trace.getSequenceId(cur_seq);
+  // A call that recorded nothing else may be aggregated from now on.
+  if (aggregator && cur_seq->size() == 2 && cur_seq->tokens[0].type == TypeEvent &&
+      thread_trace.events[cur_seq->tokens[0].id].event.record == HTF_EVENT_ENTER) {
+    const CallstackFrame& frame = getCurrentFrame();
+    observeCall(cur_seq->tokens[0].id, frame.token_starts[0], frame.token_starts[1]);
+  }
+
+  uint32_t hash = hashFold(getCurrentFrame().hash(0, cur_seq->size()));
+  Token seq_id = thread_trace.getSequenceIdFromArray(cur_seq->tokens.data(), cur_seq->size(), hash);
   auto* seq = thread_trace.sequences[seq_id.id];
-  htf_timestamp_t ts = thread_trace.getSequenceDuration(seq->tokens.data(), seq->size());
-  htf_add_timestamp_to_delta(&seq->durations->add(ts));
+  if (parameterHandler.getMaxSequences() && thread_trace.nb_sequences >= parameterHandler.getMaxSequences())
+    degrade(HTF_DEGRADATION_FLAT_SEQUENCES);
+  // The sequence ends with the next event.
+  htf_timestamp_t start = getCurrentFrame().token_starts[0];
+  timestamps->addPending(&seq->durations->add(start));
   htf_log(DebugLevel::Debug, "Exiting a function, closing sequence %d (%p)\n", seq_id.id, cur_seq);
 
+  // We need to reset the token vector
+  // Calling vector::clear() might be a better way to do that,
+  // but depending on the implementation it might force a bunch of realloc, which isn't great.
+  truncateCurrentSequence(0);
+
   cur_depth--;
   /* upper_seq is the sequence that called cur_seq */
   Sequence* upper_seq = getCurrentSequence();
@@ -409,44 +754,449 @@ void ThreadWriter::recordExitFunction() {
     htf_error("upper_seq is NULL!\n");
   }
 
-  storeToken(upper_seq, seq_id);
-  cur_seq->tokens.resize(0);
-  // We need to reset the token vector
-  // Calling vector::clear() might be a better way to do that,
-  // but depending on the implementation it might force a bunch of realloc, which isn't great.
+  storeToken(seq_id, start);
 }  // namespace htf
 
 size_t ThreadWriter::storeEvent(enum EventType event_type,
                                 TokenId event_id,
                                 htf_timestamp_t ts,
-                                AttributeList* attribute_list) {
-  if (event_type == HTF_BLOCK_START) {
-    recordEnterFunction();
+                                AttributeList* attribute_list,
+                                const uint64_t* volatile_values) {
+  ts = htf_timestamp(ts);
+  if (reorder) {
+    reorderEvent(event_type, event_id, ts, attribute_list, volatile_values);
+    return SIZE_MAX;
   }
+  return storeSortedEvent(event_type, event_id, ts, attribute_list, volatile_values);
+}
 
-  Token token = Token(TypeEvent, event_id);
-  auto* sequence = getCurrentSequence();
-  storeToken(sequence, token);
+size_t ThreadWriter::storeSortedEvent(enum EventType event_type,
+                                      TokenId event_id,
+                                      htf_timestamp_t ts,
+                                      AttributeList* attribute_list,
+                                      const uint64_t* volatile_values) {
+  if (aggregator && aggregateCall(event_type, event_id, ts, attribute_list))
+    return SIZE_MAX;
+  return storeOccurence(event_type, event_id, ts, attribute_list, volatile_values);
+}
+
+void ThreadWriter::reorderEvent(enum EventType event_type,
+                                TokenId event_id,
+                                htf_timestamp_t ts,
+                                AttributeList* attribute_list,
+                                const uint64_t* volatile_values) {
+  if (ts < reorder->last_stored) {
+    // The Events after it were already stored: it is stored as if it happened right after them.
+    thread_trace.nb_late_events++;
+    ts = reorder->last_stored;
+  }
+
+  // An Event in order is built in place at the back of the buffer. The others are inserted after the Events that
+  // are not newer than them.
+  auto& events = reorder->events;
+  if (reorder->first > 0 && 2 * reorder->first >= events.size()) {
+    events.erase(events.begin(), events.begin() + reorder->first);
+    reorder->first = 0;
+  }
+  AsyncEvent* event;
+  if (events.size() == reorder->first || events.back().ts <= ts) {
+    event = &events.emplace_back();
+  } else {
+    auto it = std::upper_bound(events.begin() + reorder->first, events.end(), ts,
+                               [](htf_timestamp_t t, const AsyncEvent& e) { return t < e.ts; });
+    event = &*events.emplace(it);
+  }
+  event->ts = ts;
+  event->event_id = event_id;
+  event->event_type = event_type;
+  // The caller may reuse its AttributeList as soon as we return.
+  event->attribute_list = attribute_list ? reorder->copyAttributeList(attribute_list) : nullptr;
+  event->has_volatile_values = volatile_values != nullptr;
+  if (volatile_values)
+    memcpy(event->volatile_values, volatile_values, sizeof(event->volatile_values));
+  reorder->newest = std::max(reorder->newest, ts);
+
+  uint64_t window = parameterHandler.getReorderWindow();
+  uint64_t max_size = parameterHandler.getReorderBufferSize();
+  while (reorder->first < events.size()) {
+    bool expired = window && events[reorder->first].ts + window <= reorder->newest;
+    bool overflow = max_size && events.size() - reorder->first > max_size;
+    if (!expired && !overflow)
+      break;
+    storeFirstReorderedEvent();
+  }
+}
+
+void ThreadWriter::storeFirstReorderedEvent() {
+  AsyncEvent& e = reorder->events[reorder->first++];
+  reorder->last_stored = e.ts;
+  const uint64_t* volatile_values = e.has_volatile_values ? e.volatile_values : nullptr;
+  storeSortedEvent(e.event_type, e.event_id, e.ts, e.attribute_list, volatile_values);
+  reorder->releaseAttributeList(e.attribute_list);
+}
+
+void ThreadWriter::flushReorderBuffer() {
+  while (reorder->first < reorder->events.size())
+    storeFirstReorderedEvent();
+  reorder->events.clear();
+  reorder->first = 0;
+}
+
+size_t ThreadWriter::storeOccurence(enum EventType event_type,
+                                    TokenId event_id,
+                                    htf_timestamp_t ts,
+                                    AttributeList* attribute_list,
+                                    const uint64_t* volatile_values) {
+  if (event_type == HTF_BLOCK_START) {
+    // Once the Sequences are flattened, the new calls stay in the current Sequence.
+    if (thread_trace.degradations & HTF_DEGRADATION_FLAT_SEQUENCES)
+      flat_depth++;
+    else
+      recordEnterFunction();
+  }
 
   EventSummary* es = &thread_trace.events[event_id];
   size_t occurrence_index = es->nb_occurences++;
 
-  storeTimestamp(es, htf_timestamp(ts));
+  storeTimestamp(es, ts);
+
+  Token token = Token(TypeEvent, event_id);
+  storeToken(token, ts);
+
   if (attribute_list)
     storeAttributeList(es, attribute_list, occurrence_index);
 
+  if (es->volatile_fields)
+    storeVolatileValues(es, volatile_values);
+
   if (event_type == HTF_BLOCK_END) {
-    recordExitFunction();
+    closeCallstackLevel();
   }
   return occurrence_index;
 }
 
+bool ThreadWriter::aggregateCall(enum EventType event_type,
+                                 TokenId event_id,
+                                 htf_timestamp_t ts,
+                                 AttributeList* attribute_list) {
+  auto* a = static_cast<CallAggregator*>(aggregator);
+  // The attributes and the volatile fields of an Event cannot be aggregated.
+  bool plain = !attribute_list && !thread_trace.events[event_id].volatile_fields;
+  if (a->pending_enter != HTF_TOKEN_ID_INVALID) {
+    if (event_type == HTF_BLOCK_END && plain) {
+      AggregatedCalls* calls = thread_trace.events[a->pending_enter].aggregated_calls;
+      htf_timestamp_t duration = ts - a->pending_start;
+      calls->nb_calls++;
+      calls->total_duration += duration;
+      calls->min_duration = std::min(calls->min_duration, duration);
+      calls->max_duration = std::max(calls->max_duration, duration);
+      a->pending_enter = HTF_TOKEN_ID_INVALID;
+      return true;
+    }
+    // This call records something else: it is stored as usual.
+    storePendingCall();
+  }
+  if (event_type == HTF_BLOCK_START && plain && thread_trace.events[event_id].aggregated_calls) {
+    a->pending_enter = event_id;
+    a->pending_start = ts;
+    return true;
+  }
+  return false;
+}
+
+void ThreadWriter::storePendingCall() {
+  auto* a = static_cast<CallAggregator*>(aggregator);
+  if (a->pending_enter == HTF_TOKEN_ID_INVALID)
+    return;
+  TokenId enter = a->pending_enter;
+  a->pending_enter = HTF_TOKEN_ID_INVALID;
+  storeOccurence(HTF_BLOCK_START, enter, a->pending_start, nullptr, nullptr);
+}
+
+void ThreadWriter::observeCall(TokenId enter, htf_timestamp_t start, htf_timestamp_t end) {
+  auto* a = static_cast<CallAggregator*>(aggregator);
+  EventSummary* es = &thread_trace.events[enter];
+  if (es->aggregated_calls)
+    return;
+  if (enter >= a->windows.size())
+    a->windows.resize(enter + 1);
+  CallAggregator::Window& w = a->windows[enter];
+  if (w.nb_calls == 0)
+    w.start = start;
+  w.nb_calls++;
+  w.total_duration += end - start;
+  if (w.nb_calls < CallAggregator::window_size)
+    return;
+
+  htf_clock_info_t clock = htf_get_clock_info();
+  double elapsed = htf_clock_to_ns(&clock, end - w.start);
+  double mean_duration = (double)htf_clock_to_ns(&clock, w.total_duration) / w.nb_calls;
+  bool aggregate = mean_duration <= parameterHandler.getAggregationMaxDuration() &&
+                   w.nb_calls * 1e9 >= parameterHandler.getAggregationMinRate() * elapsed;
+  w = CallAggregator::Window();
+  if (!aggregate)
+    return;
+
+  htf_log(DebugLevel::Verbose, "Thread %u: aggregating the calls of E%x (%.1lf ns per call)\n", thread_trace.id,
+          enter, mean_duration);
+  es->aggregated_calls = arena->create<AggregatedCalls>();
+  es->aggregated_calls->min_duration = HTF_TIMESTAMP_INVALID;
+}
+
+void ThreadWriter::recordEvent(enum EventType event_type,
+                               TokenId event_id,
+                               htf_timestamp_t ts,
+                               AttributeList* attribute_list,
+                               const uint64_t* volatile_values) {
+  if (ring)
+    pushEvent(event_type, event_id, ts, attribute_list, volatile_values);
+  else
+    storeEvent(event_type, event_id, ts, attribute_list, volatile_values);
+}
+
+void ThreadWriter::pushEvent(enum EventType event_type,
+                             TokenId event_id,
+                             htf_timestamp_t ts,
+                             AttributeList* attribute_list,
+                             const uint64_t* volatile_values) {
+  auto* event_ring = static_cast<EventRing*>(ring);
+  AsyncEvent event;
+  // The clock has to be read now, not when the Event is stored.
+  event.ts = htf_timestamp(ts);
+  event.event_id = event_id;
+  event.event_type = event_type;
+  event.has_volatile_values = volatile_values != nullptr;
+  if (volatile_values)
+    memcpy(event.volatile_values, volatile_values, sizeof(event.volatile_values));
+
+  // The caller may reuse its AttributeList as soon as we return: the ring keeps a copy of it.
+  while (!event_ring->tryPush(event, attribute_list)) {
+    // The encoder cannot keep up: store the Events ourselves rather than dropping them.
+    event_ring->nb_stalls++;
+    encodeRing();
+  }
+}
+
+size_t ThreadWriter::encodeRing() {
+  auto* event_ring = static_cast<EventRing*>(ring);
+  std::lock_guard<std::mutex> guard(event_ring->encode_lock);
+  return event_ring->drain([this](AsyncEvent& e) {
+    storeEvent(e.event_type, e.event_id, e.ts, e.attribute_list, e.has_volatile_values ? e.volatile_values : nullptr);
+  });
+}
+
+void ThreadWriter::recordEncodedEvent(enum EventType event_type,
+                                      Event* e,
+                                      htf_timestamp_t ts,
+                                      AttributeList* attribute_list) {
+  uint64_t volatile_values[maxVolatileValues];
+  if (volatile_fields)
+    extractVolatileFields(e, volatile_fields, volatile_values);
+  recordEvent(event_type, getEventId(e), ts, attribute_list, volatile_values);
+}
+
+void ThreadWriter::sendEvent(enum EventType event_type,
+                             const Event* e,
+                             htf_timestamp_t ts,
+                             AttributeList* attribute_list) {
+  auto* collector_thread = static_cast<CollectorThread*>(collector);
+  EventMessage m;
+  // The clock has to be read by the application, not by the collector.
+  m.ts = collector_thread->client->timestamp(ts);
+  m.event_type = event_type;
+  m.attribute_size = attribute_list ? attribute_list->struct_size : 0;
+  CollectorClient::sendTo(collector_thread->ring, m, e, e->event_size, attribute_list,
+                          m.attribute_size);
+}
+
+TokenId ThreadWriter::sendEventTemplate(const Event* e) {
+  auto* collector_thread = static_cast<CollectorThread*>(collector);
+  EventTemplateMessage m;
+  m.template_id = collector_thread->templates.size();
+  collector_thread->templates.push_back(_htf_event_type(e->record));
+  CollectorClient::sendTo(collector_thread->ring, m, e, e->event_size);
+  return m.template_id;
+}
+
+void ThreadWriter::sendEventById(enum EventType event_type,
+                                 TokenId template_id,
+                                 htf_timestamp_t ts,
+                                 AttributeList* attribute_list) {
+  auto* collector_thread = static_cast<CollectorThread*>(collector);
+  EventByIdMessage m;
+  m.ts = collector_thread->client->timestamp(ts);
+  m.template_id = template_id;
+  m.event_type = event_type;
+  m.attribute_size = attribute_list ? attribute_list->struct_size : 0;
+  CollectorClient::sendTo(collector_thread->ring, m, attribute_list, m.attribute_size);
+}
+
+TokenId ThreadWriter::getEventId(Event* e) {
+  // Only this thread registers Events, so looking one up is safe while an encoder stores the others.
+  TokenId id = thread_trace.findEventId(e, volatile_fields);
+  if (id != HTF_TOKEN_ID_INVALID)
+    return id;
+  if (ring) {
+    // Registering an Event may move Thread::events and allocates from the arena, which the encoder also uses.
+    std::lock_guard<std::mutex> guard(static_cast<EventRing*>(ring)->encode_lock);
+    id = thread_trace.getEventId(e, volatile_fields);
+  } else {
+    id = thread_trace.getEventId(e, volatile_fields);
+  }
+  // Most distinct Events only differ by their fields: the next ones are stored per occurence instead.
+  // Thread::degradations is only updated on close, since an encoder may be updating it.
+  if (parameterHandler.getMaxEvents() && thread_trace.nb_events >= parameterHandler.getMaxEvents() &&
+      volatile_fields != allVolatileFields) {
+    htf_warn("Thread %u has %u distinct Events: the fields of its next Events are stored per occurence\n",
+             thread_trace.id, thread_trace.nb_events);
+    volatile_fields = allVolatileFields;
+  }
+  return id;
+}
+
+void ThreadWriter::setMeasurement(enum MeasurementMode mode, htf_timestamp_t ts) {
+  bool off = mode == HTF_MEASUREMENT_OFF;
+  if (isMeasurementOff() == off)
+    return;
+  // The OFF marker is the last Event before the gap: its duration is the length of the gap.
+  // The skipped Events first closed calls that were open before the gap, then opened calls that are still open.
+  int nb_closed = off ? 0 : -skipped_min_depth;
+  int nb_opened = off ? 0 : skipped_depth - skipped_min_depth;
+  if (collector) {
+    auto* collector_thread = static_cast<CollectorThread*>(collector);
+    MeasurementOnOffMessage m;
+    m.ts = collector_thread->client->timestamp(ts);
+    m.nb_closed = nb_closed;
+    m.nb_opened = nb_opened;
+    m.mode = mode;
+    CollectorClient::sendTo(collector_thread->ring, m);
+  } else {
+    recordMeasurementOnOff(mode, ts, nb_closed, nb_opened);
+  }
+  skipped_depth = 0;
+  skipped_min_depth = 0;
+  __atomic_store_n(&measurement_off, off, __ATOMIC_RELAXED);
+}
+
+void ThreadWriter::recordMeasurementOnOff(enum MeasurementMode mode, htf_timestamp_t ts, int nb_closed, int nb_opened) {
+  if (!ring) {
+    storeMeasurementOnOff(mode, ts, nb_closed, nb_opened);
+    return;
+  }
+  // The levels of the callstack belong to the encoder: the Events before the marker have to be stored first.
+  encodeRing();
+  std::lock_guard<std::mutex> guard(static_cast<EventRing*>(ring)->encode_lock);
+  storeMeasurementOnOff(mode, ts, nb_closed, nb_opened);
+}
+
+void ThreadWriter::storeMeasurementOnOff(enum MeasurementMode mode, htf_timestamp_t ts, int nb_closed, int nb_opened) {
+  Event e;
+  encodeEvent(&e, MeasurementOnOffRecord{(uint8_t)mode});
+  TokenId id = thread_trace.getEventId(&e, volatile_fields);
+  ts = htf_timestamp(ts);
+  if (reorder) {
+    // The gap splits the Events in two: those recorded before it are not reordered with those recorded after it.
+    flushReorderBuffer();
+    reorder->last_stored = std::max(reorder->last_stored, ts);
+  }
+  if (aggregator)
+    storePendingCall();
+  if (nb_closed == 0 && nb_opened == 0) {
+    storeSortedEvent(HTF_SINGLETON, id, ts, nullptr, nullptr);
+    return;
+  }
+  // The calls that ended during the gap end with the marker, those that started during the gap start with it.
+  for (int i = 0; i < nb_closed; i++)
+    storeSortedEvent(HTF_BLOCK_END, id, ts, nullptr, nullptr);
+  for (int i = 0; i < nb_opened; i++)
+    storeSortedEvent(HTF_BLOCK_START, id, ts, nullptr, nullptr);
+}
+
+void ThreadWriter::closeCallstackLevel() {
+  if (flat_depth > 0)
+    flat_depth--;
+  else if (cur_depth > 0)
+    recordExitFunction();
+}
+
 void ThreadWriter::threadClose() {
+  if (collector) {
+    CollectorClient::closeThread(static_cast<CollectorThread*>(collector));
+    collector = nullptr;
+    return;
+  }
+  if (ring) {
+    auto* event_ring = static_cast<EventRing*>(ring);
+    AsyncEncoder::detach(this);
+    encodeRing();
+    htf_log(DebugLevel::Verbose, "Thread %u: the asynchronous ring was full %zu times\n", thread_trace.id,
+            event_ring->nb_stalls);
+    delete event_ring;
+    ring = nullptr;
+  }
+  if (reorder) {
+    flushReorderBuffer();
+    reorder = nullptr;
+  }
+  if (thread_trace.nb_late_events)
+    htf_warn("Thread %u: %zu events arrived after the reorder window\n", thread_trace.id, thread_trace.nb_late_events);
+  if (aggregator) {
+    storePendingCall();
+    aggregator = nullptr;
+  }
+  if (volatile_fields != parameterHandler.getVolatileFields())
+    thread_trace.degradations |= HTF_DEGRADATION_PAYLOAD_COLUMNS;
+  if (thread_trace.nb_dropped_attributes)
+    htf_warn("Thread %u: %zu attribute lists were dropped\n", thread_trace.id, thread_trace.nb_dropped_attributes);
   while (cur_depth > 0) {
     htf_warn("Closing unfinished sequence (lvl %d)\n", cur_depth);
     recordExitFunction();
   }
+  resolveDurations();
+  if (parameterHandler.getAdaptiveLoopLength()) {
+    // The levels of the callstack that were reached are the first ones.
+    while (thread_trace.nb_max_loop_lengths < (unsigned)max_depth && frames[thread_trace.nb_max_loop_lengths])
+      thread_trace.nb_max_loop_lengths++;
+    thread_trace.max_loop_lengths = arena->allocateArray<size_t>(thread_trace.nb_max_loop_lengths);
+    for (unsigned i = 0; i < thread_trace.nb_max_loop_lengths; i++)
+      thread_trace.max_loop_lengths[i] = frames[i]->max_loop_length;
+  }
   thread_trace.finalizeThread();
+
+  loop_lengths = nullptr;
+  if (recycled) {
+    // The next Thread of this ThreadWriter is about as large: keep the buffers, empty.
+    thread_trace.clearThread();
+    arena->reset();
+    memset(og_seq, 0, max_depth * sizeof(Sequence*));
+    memset(frames, 0, max_depth * sizeof(CallstackFrame*));
+    return;
+  }
+  freeBuffers();
+}
+
+void ThreadWriter::freeBuffers() {
+  // The Thread is now stored: free everything that was allocated to write it in one go.
+  thread_trace.releaseThread();
+  delete arena;
+  arena = nullptr;
+  delete timestamps;
+  timestamps = nullptr;
+  free(og_seq);
+  og_seq = nullptr;
+  free(frames);
+  frames = nullptr;
+}
+
+void ThreadWriter::resolveDurations() {
+  timestamps->resolve();
+  const htf_timestamp_t* deltas = timestamps->timestamps.data();
+  for (int i = 0; i < thread_trace.nb_events; i++) {
+    for (auto& d : *thread_trace.events[i].durations) {
+      d = deltas[d];
+    }
+  }
+  timestamps->clear();
 }
 
 void Archive::open(const char* dirname, const char* given_trace_name, LocationGroupId archive_id) {
@@ -467,12 +1217,36 @@ void Archive::open(const char* dirname, const char* given_trace_name, LocationGr
   nb_threads = 0;
   threads = new Thread*[nb_allocated_threads];
 
-  htf_storage_init(this);
+  if (auto* client = CollectorClient::get()) {
+    // The collector creates the directory and writes the files of the trace.
+    ArchiveOpenMessage m;
+    m.archive = (uintptr_t)this;
+    m.id = archive_id;
+    m.dir_name_size = strlen(dir_name) + 1;
+    client->send(m, dir_name, m.dir_name_size, trace_name, strlen(trace_name) + 1);
+  } else {
+    htf_storage_init(this);
+  }
 
   htf_recursion_shield--;
 }
 
 void ThreadWriter::open(Archive* archive, ThreadId thread_id) {
+  recycled = 0;
+  openThread(archive, thread_id, 1);
+}
+
+void ThreadWriter::reopen(Archive* archive, ThreadId thread_id) {
+  htf_assert(recycled);
+  openThread(archive, thread_id, 1);
+}
+
+void ThreadWriter::openStream(Archive* archive, ThreadId thread_id, unsigned nb_streams) {
+  recycled = 0;
+  openThread(archive, thread_id, nb_streams);
+}
+
+void ThreadWriter::openThread(Archive* archive, ThreadId thread_id, unsigned nb_streams) {
   if (htf_recursion_shield)
     return;
   htf_recursion_shield++;
@@ -481,18 +1255,59 @@ void ThreadWriter::open(Archive* archive, ThreadId thread_id) {
 
   htf_log(DebugLevel::Debug, "htf_write_thread_open(%ux)\n", thread_id);
 
-  thread_trace.initThread(archive, thread_id);
-  max_depth = CALLSTACK_DEPTH_DEFAULT;
-  og_seq = new Sequence*[max_depth];
+  ring = nullptr;
+  collector = nullptr;
+  aggregator = nullptr;
+  reorder = nullptr;
+  volatile_fields = parameterHandler.getVolatileFields();
+  flat_depth = 0;
+  measurement_off = 0;
+  skipped_depth = 0;
+  skipped_min_depth = 0;
+  if (auto* client = CollectorClient::get()) {
+    // The Thread is written by the collector: this ThreadWriter only forwards the Events.
+    size_t ring_size = parameterHandler.getCollectorRingSize();
+    if (nb_streams > 1)
+      ring_size = std::max<size_t>(ring_size / nb_streams, STREAM_COLLECTOR_RING_SIZE_MIN);
+    collector = client->openThread((uintptr_t)archive, thread_id, ring_size);
+    htf_recursion_shield--;
+    return;
+  }
+
+  // The buffers of a recycled ThreadWriter were emptied when its previous Thread was closed.
+  bool keep_buffers = recycled && arena;
+  if (!keep_buffers) {
+    arena = new Arena();
+    max_depth = CALLSTACK_DEPTH_DEFAULT;
+    og_seq = (Sequence**)calloc(max_depth, sizeof(Sequence*));
+    frames = (CallstackFrame**)calloc(max_depth, sizeof(CallstackFrame*));
+    timestamps = new TimestampBuffer();
+  }
+  thread_trace.initThread(archive, thread_id, arena, keep_buffers);
+  loop_lengths = nullptr;
+  if (parameterHandler.getParametricLoops())
+    loop_lengths = arena->create<std::vector<size_t>>();
+  aggregator = nullptr;
+  if (parameterHandler.getAggregationMinRate())
+    aggregator = arena->create<CallAggregator>();
+  reorder = nullptr;
+  if (parameterHandler.getReorderWindow() || parameterHandler.getReorderBufferSize())
+    reorder = arena->create<ReorderBuffer>();
+  // The levels of the callstack are only created when they are reached, see recordEnterFunction.
 
   // the main sequence is in sequences[0]
   og_seq[0] = thread_trace.sequences[0];
   thread_trace.nb_sequences = 1;
+  createCallstackLevel(0);
+  cur_depth = 0;
 
-  for (int i = 1; i < max_depth; i++) {
-    og_seq[i] = new Sequence();
+  if (parameterHandler.getAsyncRecording()) {
+    size_t ring_size = parameterHandler.getAsyncRingSize();
+    if (nb_streams > 1)
+      ring_size = std::max<size_t>(ring_size / nb_streams, STREAM_ASYNC_RING_SIZE_MIN);
+    ring = new EventRing(ring_size);
+    AsyncEncoder::attach(this);
   }
-  cur_depth = 0;
 
   htf_recursion_shield--;
 }
@@ -508,6 +1323,15 @@ void Archive::defineLocationGroup(LocationGroupId id, StringRef name, LocationGr
   l.parent = parent;
   location_groups.push_back(l);
   pthread_mutex_unlock(&lock);
+
+  if (auto* client = CollectorClient::get()) {
+    LocationMessage<CollectorMessageType::LocationGroup> m;
+    m.archive = (uintptr_t)this;
+    m.id = id;
+    m.name = name;
+    m.parent = parent;
+    client->send(m);
+  }
 }
 
 /**
@@ -522,57 +1346,43 @@ void Archive::defineLocation(ThreadId id, StringRef name, LocationGroupId parent
   l.parent = parent;
   locations.push_back(l);
   pthread_mutex_unlock(&lock);
-}
-
-void Archive::close() {
-  htf_storage_finalize(this);
-}
-
-static inline void init_event(Event* e, enum Record record) {
-  e->event_size = offsetof(Event, event_data);
-  e->record = record;
-  memset(&e->event_data[0], 0, sizeof(e->event_data));
-}
 
-static inline void push_data(Event* e, void* data, size_t data_size) {
-  size_t o = e->event_size - offsetof(Event, event_data);
-  htf_assert(o < 256);
-  htf_assert(o + data_size < 256);
-  memcpy(&e->event_data[o], data, data_size);
-  e->event_size += data_size;
+  if (auto* client = CollectorClient::get()) {
+    LocationMessage<CollectorMessageType::Location> m;
+    m.archive = (uintptr_t)this;
+    m.id = id;
+    m.name = name;
+    m.parent = parent;
+    client->send(m);
+  }
 }
 
-static inline void pop_data(Event* e, void* data, size_t data_size, byte*& cursor) {
-  if (cursor == nullptr) {
-    /* initialize the cursor to the begining of event data */
-    cursor = &e->event_data[0];
+void Archive::close() {
+  // The pooled ThreadWriters of short-lived threads may still be writing their Thread.
+  threadWriterPool.closeArchive(this);
+  if (auto* client = CollectorClient::get()) {
+    ArchiveCloseMessage m;
+    m.archive = (uintptr_t)this;
+    client->send(m);
+    return;
   }
-
-  uintptr_t last_event_byte = ((uintptr_t)e) + e->event_size;
-  uintptr_t last_read_byte = ((uintptr_t)cursor) + data_size;
-  htf_assert(last_read_byte <= last_event_byte);
-
-  memcpy(data, cursor, data_size);
-  cursor += data_size;
+  htf_storage_finalize(this);
 }
 
 void Thread::printEvent(htf::Event* e) const {
-  byte* cursor = nullptr;
   switch (e->record) {
   case HTF_EVENT_ENTER: {
-    RegionRef region_ref;
-    pop_data(e, &region_ref, sizeof(region_ref), cursor);
-    const Region* region = archive->getRegion(region_ref);
+    auto r = decodeEvent<EnterRecord>(e);
+    const Region* region = archive->getRegion(r.region_ref);
     const char* region_name = region ? archive->getString(region->string_ref)->str : "INVALID";
-    printf("Enter %d (%s)", region_ref, region_name);
+    printf("Enter %d (%s)", r.region_ref, region_name);
     break;
   }
   case HTF_EVENT_LEAVE: {
-    RegionRef region_ref;
-    pop_data(e, &region_ref, sizeof(region_ref), cursor);
-    const Region* region = archive->getRegion(region_ref);
+    auto r = decodeEvent<LeaveRecord>(e);
+    const Region* region = archive->getRegion(r.region_ref);
     const char* region_name = region ? archive->getString(region->string_ref)->str : "INVALID";
-    printf("Leave %d (%s)", region_ref, region_name);
+    printf("Leave %d (%s)", r.region_ref, region_name);
     break;
   }
 
@@ -592,75 +1402,43 @@ void Thread::printEvent(htf::Event* e) const {
     printf("THREAD_TEAM_END()");
     break;
 
+  case HTF_EVENT_MEASUREMENT_ON_OFF: {
+    auto r = decodeEvent<MeasurementOnOffRecord>(e);
+    printf("MEASUREMENT_%s()", r.measurementMode == HTF_MEASUREMENT_OFF ? "OFF" : "ON");
+    break;
+  }
   case HTF_EVENT_MPI_SEND: {
-    uint32_t receiver;
-    uint32_t communicator;
-    uint32_t msgTag;
-    uint64_t msgLength;
-
-    pop_data(e, &receiver, sizeof(receiver), cursor);
-    pop_data(e, &communicator, sizeof(communicator), cursor);
-    pop_data(e, &msgTag, sizeof(msgTag), cursor);
-    pop_data(e, &msgLength, sizeof(msgLength), cursor);
-    printf("MPI_SEND(dest=%d, comm=%x, tag=%x, len=%" PRIu64 ")", receiver, communicator, msgTag, msgLength);
+    auto r = decodeEvent<MpiSendRecord>(e);
+    printf("MPI_SEND(dest=%d, comm=%x, tag=%x, len=%" PRIu64 ")", r.receiver, r.communicator, r.msgTag,
+           (uint64_t)r.msgLength);
     break;
   }
   case HTF_EVENT_MPI_ISEND: {
-    uint32_t receiver;
-    uint32_t communicator;
-    uint32_t msgTag;
-    uint64_t msgLength;
-    uint64_t requestID;
-
-    pop_data(e, &receiver, sizeof(receiver), cursor);
-    pop_data(e, &communicator, sizeof(communicator), cursor);
-    pop_data(e, &msgTag, sizeof(msgTag), cursor);
-    pop_data(e, &msgLength, sizeof(msgLength), cursor);
-    pop_data(e, &requestID, sizeof(requestID), cursor);
-    printf("MPI_ISEND(dest=%d, comm=%x, tag=%x, len=%" PRIu64 ", req=%" PRIx64 ")", receiver, communicator, msgTag,
-           msgLength, requestID);
+    auto r = decodeEvent<MpiIsendRecord>(e);
+    printf("MPI_ISEND(dest=%d, comm=%x, tag=%x, len=%" PRIu64 ", req=%" PRIx64 ")", r.receiver, r.communicator,
+           r.msgTag, (uint64_t)r.msgLength, (uint64_t)r.requestID);
     break;
   }
   case HTF_EVENT_MPI_ISEND_COMPLETE: {
-    uint64_t requestID;
-    pop_data(e, &requestID, sizeof(requestID), cursor);
-    printf("MPI_ISEND_COMPLETE(req=%" PRIx64 ")", requestID);
+    auto r = decodeEvent<MpiIsendCompleteRecord>(e);
+    printf("MPI_ISEND_COMPLETE(req=%" PRIx64 ")", (uint64_t)r.requestID);
     break;
   }
   case HTF_EVENT_MPI_IRECV_REQUEST: {
-    uint64_t requestID;
-    pop_data(e, &requestID, sizeof(requestID), cursor);
-    printf("MPI_IRECV_REQUEST(req=%" PRIx64 ")", requestID);
+    auto r = decodeEvent<MpiIrecvRequestRecord>(e);
+    printf("MPI_IRECV_REQUEST(req=%" PRIx64 ")", (uint64_t)r.requestID);
     break;
   }
   case HTF_EVENT_MPI_RECV: {
-    uint32_t sender;
-    uint32_t communicator;
-    uint32_t msgTag;
-    uint64_t msgLength;
-
-    pop_data(e, &sender, sizeof(sender), cursor);
-    pop_data(e, &communicator, sizeof(communicator), cursor);
-    pop_data(e, &msgTag, sizeof(msgTag), cursor);
-    pop_data(e, &msgLength, sizeof(msgLength), cursor);
-
-    printf("MPI_RECV(src=%d, comm=%x, tag=%x, len=%" PRIu64 ")", sender, communicator, msgTag, msgLength);
+    auto r = decodeEvent<MpiRecvRecord>(e);
+    printf("MPI_RECV(src=%d, comm=%x, tag=%x, len=%" PRIu64 ")", r.sender, r.communicator, r.msgTag,
+           (uint64_t)r.msgLength);
     break;
   }
   case HTF_EVENT_MPI_IRECV: {
-    uint32_t sender;
-    uint32_t communicator;
-    uint32_t msgTag;
-    uint64_t msgLength;
-    uint64_t requestID;
-    pop_data(e, &sender, sizeof(sender), cursor);
-    pop_data(e, &communicator, sizeof(communicator), cursor);
-    pop_data(e, &msgTag, sizeof(msgTag), cursor);
-    pop_data(e, &msgLength, sizeof(msgLength), cursor);
-    pop_data(e, &requestID, sizeof(requestID), cursor);
-
-    printf("MPI_IRECV(src=%d, comm=%x, tag=%x, len=%" PRIu64 ", req=%" PRIu64 ")", sender, communicator, msgTag,
-           msgLength, requestID);
+    auto r = decodeEvent<MpiIrecvRecord>(e);
+    printf("MPI_IRECV(src=%d, comm=%x, tag=%x, len=%" PRIu64 ", req=%" PRIu64 ")", r.sender, r.communicator,
+           r.msgTag, (uint64_t)r.msgLength, (uint64_t)r.requestID);
     break;
   }
   case HTF_EVENT_MPI_COLLECTIVE_BEGIN: {
@@ -668,20 +1446,9 @@ void Thread::printEvent(htf::Event* e) const {
     break;
   }
   case HTF_EVENT_MPI_COLLECTIVE_END: {
-    uint32_t collectiveOp;
-    uint32_t communicator;
-    uint32_t root;
-    uint64_t sizeSent;
-    uint64_t sizeReceived;
-
-    pop_data(e, &collectiveOp, sizeof(collectiveOp), cursor);
-    pop_data(e, &communicator, sizeof(communicator), cursor);
-    pop_data(e, &root, sizeof(root), cursor);
-    pop_data(e, &sizeSent, sizeof(sizeSent), cursor);
-    pop_data(e, &sizeReceived, sizeof(sizeReceived), cursor);
-
-    printf("MPI_COLLECTIVE_END(op=%x, comm=%x, root=%d, sent=%" PRIu64 ", recved=%" PRIu64 ")", collectiveOp,
-           communicator, root, sizeSent, sizeReceived);
+    auto r = decodeEvent<MpiCollectiveEndRecord>(e);
+    printf("MPI_COLLECTIVE_END(op=%x, comm=%x, root=%d, sent=%" PRIu64 ", recved=%" PRIu64 ")", r.collectiveOp,
+           r.communicator, r.root, (uint64_t)r.sizeSent, (uint64_t)r.sizeReceived);
     break;
   }
   default:
@@ -689,36 +1456,107 @@ void Thread::printEvent(htf::Event* e) const {
   }
 }
 
-void EventSummary::initEventSummary(TokenId token_id, const Event& e) {
+void EventSummary::initEventSummary(TokenId token_id, const Event& e, uint32_t volatile_fields_mask) {
   id = token_id;
   nb_occurences = 0;
   attribute_buffer = 0;
   attribute_buffer_size = 0;
   attribute_pos = 0;
-  memcpy(&event, &e, sizeof(e));
+  volatile_fields = volatileFieldsOf(e.record) & volatile_fields_mask;
+  volatile_values = nullptr;
+  volatile_values_size = 0;
+  aggregated_calls = nullptr;
+  // Only the first event_size bytes of e are set, the rest is zeroed so that the stored Event is deterministic.
+  memcpy(&event, &e, e.event_size);
+  memset(reinterpret_cast<uint8_t*>(&event) + e.event_size, 0, sizeof(event) - e.event_size);
+}
+
+/**
+ * Returns the hash of the meaningful bytes of an Event (its record and its data up to event_size).
+ */
+static inline uint32_t _htf_event_hash(const Event* e) {
+  uint32_t hash;
+  hash32Bytes(e, e->event_size, SEED, &hash);
+  return hash;
+}
+
+/**
+ * Returns whether an EventSummary holds the given Event, whose `volatile_fields` were removed.
+ *
+ * The fields of an Event recorded with fewer volatile fields may have been 0, so the fields have to match too.
+ */
+static inline bool _htf_event_matches(const EventSummary& es, const Event* e, uint32_t volatile_fields) {
+  if (memcmp(e, &es.event, e->event_size) != 0)
+    return false;
+  return (volatile_fields & ~es.volatile_fields) == 0 ||
+         es.volatile_fields == (volatileFieldsOf(e->record) & volatile_fields);
+}
+
+/**
+ * Rebuilds the event index of a Thread with enough slots for one more event.
+ *
+ * The index only stores ids, so it stays valid when DOUBLE_MEMORY_SPACE moves #Thread::events.
+ */
+static void _htf_grow_event_index(Thread* thread) {
+  unsigned nb_slots = thread->event_index_size ? thread->event_index_size : 16;
+  while (nb_slots < 2 * (thread->nb_events + 1))
+    nb_slots *= 2;
+  htf_log(DebugLevel::Debug, "Resizing event index of thread %p to %u slots\n", thread, nb_slots);
+
+  delete[] thread->event_index;
+  thread->event_index = new TokenId[nb_slots];
+  thread->event_index_size = nb_slots;
+  std::fill_n(thread->event_index, nb_slots, HTF_TOKEN_ID_INVALID);
+
+  for (TokenId i = 0; i < thread->nb_events; i++) {
+    size_t slot = _htf_event_hash(&thread->events[i].event) & (nb_slots - 1);
+    while (thread->event_index[slot] != HTF_TOKEN_ID_INVALID)
+      slot = (slot + 1) & (nb_slots - 1);
+    thread->event_index[slot] = i;
+  }
 }
 
-TokenId Thread::getEventId(htf::Event* e) {
+TokenId Thread::findEventId(const htf::Event* e, uint32_t volatile_fields) const {
+  if (event_index_size == 0)
+    return HTF_TOKEN_ID_INVALID;
+  size_t slot = _htf_event_hash(e) & (event_index_size - 1);
+  for (; event_index[slot] != HTF_TOKEN_ID_INVALID; slot = (slot + 1) & (event_index_size - 1)) {
+    TokenId i = event_index[slot];
+    if (_htf_event_matches(events[i], e, volatile_fields))
+      return i;
+  }
+  return HTF_TOKEN_ID_INVALID;
+}
+
+TokenId Thread::getEventId(htf::Event* e, uint32_t volatile_fields) {
   htf_log(DebugLevel::Max, "Searching for event {.event_type=%d}\n", e->record);
 
   htf_assert(e->event_size < 256);
 
-  for (TokenId i = 0; i < nb_events; i++) {
-    if (memcmp(e, &events[i].event, e->event_size) == 0) {
+  if (2 * (nb_events + 1) > event_index_size) {
+    _htf_grow_event_index(this);
+  }
+
+  size_t slot = _htf_event_hash(e) & (event_index_size - 1);
+  for (; event_index[slot] != HTF_TOKEN_ID_INVALID; slot = (slot + 1) & (event_index_size - 1)) {
+    TokenId i = event_index[slot];
+    if (_htf_event_matches(events[i], e, volatile_fields)) {
       htf_log(DebugLevel::Max, "\t found with id=%u\n", i);
       return i;
     }
   }
 
   if (nb_events >= nb_allocated_events) {
-    htf_warn("Doubling mem space of events for thread trace %p\n", this);
+    htf_log(DebugLevel::Debug, "Doubling mem space of events for thread trace %p\n", this);
     DOUBLE_MEMORY_SPACE(events, nb_allocated_events, EventSummary);
   }
 
   TokenId index = nb_events++;
   htf_log(DebugLevel::Max, "\tNot found. Adding it with id=%x\n", index);
   auto* new_event = &events[index];
-  new_event->initEventSummary(id, *e);
+  new_event->initEventSummary(index, *e, volatile_fields);
+  new_event->durations = newDurations();
+  event_index[slot] = index;
 
   return index;
 }
@@ -777,6 +1615,21 @@ extern void htf_write_thread_close(htf::ThreadWriter* thread_writer) {
   thread_writer->threadClose();
 };
 
+extern htf::ThreadWriter* htf_write_streams_open(htf::Archive* archive,
+                                                 htf::ThreadId first_thread_id,
+                                                 unsigned nb_streams) {
+  auto* streams = new htf::ThreadWriter[nb_streams]();
+  for (unsigned i = 0; i < nb_streams; i++)
+    streams[i].openStream(archive, first_thread_id + i, nb_streams);
+  return streams;
+}
+
+extern void htf_write_streams_close(htf::ThreadWriter* streams, unsigned nb_streams) {
+  for (unsigned i = 0; i < nb_streams; i++)
+    streams[i].threadClose();
+  delete[] streams;
+}
+
 extern void htf_write_define_location_group(htf::Archive* archive,
                                             htf::LocationGroupId id,
                                             htf::StringRef name,
@@ -807,107 +1660,171 @@ void htf_store_event(HTF(ThreadWriter) * thread_writer,
                      HTF(TokenId) id,
                      htf_timestamp_t ts,
                      HTF(AttributeList) * attribute_list) {
-  thread_writer->storeEvent(event_type, id, ts, attribute_list);
+  if (id == HTF_TOKEN_ID_FILTERED)
+    return;
+  if (thread_writer->isMeasurementOff()) {
+    thread_writer->skipEvent(event_type);
+    return;
+  }
+  if (thread_writer->collector)
+    thread_writer->sendEventById(event_type, id, ts, attribute_list);
+  else
+    thread_writer->recordEvent(event_type, id, ts, attribute_list);
 };
 
-void htf_record_enter(htf::ThreadWriter* thread_writer,
-                      struct htf::AttributeList* attribute_list __attribute__((unused)),
-                      htf_timestamp_t time,
-                      htf::RegionRef region_ref) {
+htf::TokenId htf_register_event_template(htf::ThreadWriter* thread_writer,
+                                         enum htf::Record record,
+                                         const void* payload,
+                                         size_t payload_size) {
+  htf_recursion_shield++;
+  htf_assert(payload_size < sizeof(htf::Event::event_data));
+  if ((record == htf::HTF_EVENT_ENTER || record == htf::HTF_EVENT_LEAVE) && payload_size >= sizeof(htf::RegionRef)) {
+    htf::RegionRef region_ref;
+    memcpy(&region_ref, payload, sizeof(region_ref));
+    if (htf::regionFilter.isFiltered(region_ref)) {
+      htf_recursion_shield--;
+      return HTF_TOKEN_ID_FILTERED;
+    }
+  }
+  htf::Event e;
+  e.record = record;
+  e.event_size = offsetof(htf::Event, event_data) + payload_size;
+  memcpy(e.event_data, payload, payload_size);
+  if (thread_writer->collector) {
+    htf::TokenId id = thread_writer->sendEventTemplate(&e);
+    htf_recursion_shield--;
+    return id;
+  }
+  // The template is shared by all its occurences, so it cannot hold per-occurence values.
+  uint64_t volatile_values[htf::maxVolatileValues];
+  if (htf::extractVolatileFields(&e, thread_writer->volatile_fields, volatile_values) > 0)
+    htf_log(htf::DebugLevel::Verbose, "The volatile fields of a template are recorded as 0\n");
+  htf::TokenId id = thread_writer->getEventId(&e);
+  htf_recursion_shield--;
+  return id;
+}
+
+void htf_measurement_off(htf::ThreadWriter* thread_writer, htf_timestamp_t time) {
   if (htf_recursion_shield)
     return;
   htf_recursion_shield++;
+  thread_writer->setMeasurement(htf::HTF_MEASUREMENT_OFF, time);
+  htf_recursion_shield--;
+}
 
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_ENTER);
+void htf_measurement_on(htf::ThreadWriter* thread_writer, htf_timestamp_t time) {
+  if (htf_recursion_shield)
+    return;
+  htf_recursion_shield++;
+  thread_writer->setMeasurement(htf::HTF_MEASUREMENT_ON, time);
+  htf_recursion_shield--;
+}
 
-  push_data(&e, &region_ref, sizeof(region_ref));
+/** Returns how an Event registered with htf_register_event_template changes the callstack. */
+static enum htf::EventType _htf_template_event_type(htf::ThreadWriter* thread_writer, htf::TokenId id) {
+  if (thread_writer->collector) {
+    auto* collector = static_cast<htf::CollectorThread*>(thread_writer->collector);
+    htf_assert(id < collector->templates.size());
+    return collector->templates[id];
+  }
+  htf_assert(id < (htf::TokenId)thread_writer->thread_trace.nb_events);
+  return _htf_event_type(thread_writer->thread_trace.events[id].event.record);
+}
 
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
+void htf_record_event_by_id(htf::ThreadWriter* thread_writer,
+                            htf::TokenId id,
+                            htf_timestamp_t time,
+                            struct htf::AttributeList* attribute_list) {
+  if (thread_writer->isMeasurementOff()) {
+    if (id != HTF_TOKEN_ID_FILTERED)
+      thread_writer->skipEvent(_htf_template_event_type(thread_writer, id));
+    return;
+  }
+  if (htf_recursion_shield || id == HTF_TOKEN_ID_FILTERED)
+    return;
+  htf_recursion_shield++;
 
-  thread_writer->storeEvent(htf::HTF_BLOCK_START, e_id, time, attribute_list);
+  enum htf::EventType event_type = _htf_template_event_type(thread_writer, id);
+  if (thread_writer->collector)
+    thread_writer->sendEventById(event_type, id, time, attribute_list);
+  else
+    thread_writer->recordEvent(event_type, id, time, attribute_list);
 
   htf_recursion_shield--;
 }
 
-void htf_record_leave(htf::ThreadWriter* thread_writer,
-                      struct htf::AttributeList* attribute_list __attribute__((unused)),
-                      htf_timestamp_t time,
-                      htf::RegionRef region_ref) {
+/** Records an Event whose payload is described by the schema R. */
+template <class R>
+static inline void _htf_record(htf::ThreadWriter* thread_writer,
+                               struct htf::AttributeList* attribute_list,
+                               htf_timestamp_t time,
+                               const R& payload) {
+  if (thread_writer->isMeasurementOff()) {
+    thread_writer->skipEvent(R::event_type);
+    return;
+  }
   if (htf_recursion_shield)
     return;
   htf_recursion_shield++;
 
   htf::Event e;
-  init_event(&e, htf::HTF_EVENT_LEAVE);
+  htf::encodeEvent(&e, payload);
+  if (thread_writer->collector) {
+    thread_writer->sendEvent(R::event_type, &e, time, attribute_list);
+    htf_recursion_shield--;
+    return;
+  }
+  uint64_t volatile_values[htf::maxVolatileValues];
+  if constexpr (htf::payloadSize<R>() > 0) {
+    if (thread_writer->volatile_fields)
+      htf::extractVolatileFields(&e, thread_writer->volatile_fields, volatile_values);
+  }
+  htf::TokenId e_id = thread_writer->getEventId(&e);
+  thread_writer->recordEvent(R::event_type, e_id, time, attribute_list, volatile_values);
 
-  push_data(&e, &region_ref, sizeof(region_ref));
+  htf_recursion_shield--;
+}
 
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_BLOCK_END, e_id, time, attribute_list);
+void htf_record_enter(htf::ThreadWriter* thread_writer,
+                      struct htf::AttributeList* attribute_list __attribute__((unused)),
+                      htf_timestamp_t time,
+                      htf::RegionRef region_ref) {
+  if (htf::regionFilter.isFiltered(region_ref))
+    return;
+  _htf_record(thread_writer, attribute_list, time, htf::EnterRecord{region_ref});
+}
 
-  htf_recursion_shield--;
+void htf_record_leave(htf::ThreadWriter* thread_writer,
+                      struct htf::AttributeList* attribute_list __attribute__((unused)),
+                      htf_timestamp_t time,
+                      htf::RegionRef region_ref) {
+  if (htf::regionFilter.isFiltered(region_ref))
+    return;
+  _htf_record(thread_writer, attribute_list, time, htf::LeaveRecord{region_ref});
 }
 
 void htf_record_thread_begin(htf::ThreadWriter* thread_writer,
                              struct htf::AttributeList* attribute_list __attribute__((unused)),
                              htf_timestamp_t time) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_THREAD_BEGIN);
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_BLOCK_START, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
+  _htf_record(thread_writer, attribute_list, time, htf::ThreadBeginRecord{});
 }
 
 void htf_record_thread_end(htf::ThreadWriter* thread_writer,
                            struct htf::AttributeList* attribute_list __attribute__((unused)),
                            htf_timestamp_t time) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_THREAD_END);
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_BLOCK_END, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
+  _htf_record(thread_writer, attribute_list, time, htf::ThreadEndRecord{});
 }
 
 void htf_record_thread_team_begin(htf::ThreadWriter* thread_writer,
                                   struct htf::AttributeList* attribute_list __attribute__((unused)),
                                   htf_timestamp_t time) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_THREAD_TEAM_BEGIN);
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_BLOCK_START, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
+  _htf_record(thread_writer, attribute_list, time, htf::ThreadTeamBeginRecord{});
 }
 
 void htf_record_thread_team_end(htf::ThreadWriter* thread_writer,
                                 struct htf::AttributeList* attribute_list __attribute__((unused)),
                                 htf_timestamp_t time) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_THREAD_TEAM_END);
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_BLOCK_END, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
+  _htf_record(thread_writer, attribute_list, time, htf::ThreadTeamEndRecord{});
 }
 
 void htf_record_mpi_send(htf::ThreadWriter* thread_writer,
@@ -917,23 +1834,7 @@ void htf_record_mpi_send(htf::ThreadWriter* thread_writer,
                          uint32_t communicator,
                          uint32_t msgTag,
                          uint64_t msgLength) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_SEND);
-
-  push_data(&e, &receiver, sizeof(receiver));
-  push_data(&e, &communicator, sizeof(communicator));
-  push_data(&e, &msgTag, sizeof(msgTag));
-  push_data(&e, &msgLength, sizeof(msgLength));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiSendRecord{receiver, communicator, msgTag, msgLength});
 }
 
 void htf_record_mpi_isend(htf::ThreadWriter* thread_writer,
@@ -944,64 +1845,21 @@ void htf_record_mpi_isend(htf::ThreadWriter* thread_writer,
                           uint32_t msgTag,
                           uint64_t msgLength,
                           uint64_t requestID) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_ISEND);
-
-  push_data(&e, &receiver, sizeof(receiver));
-  push_data(&e, &communicator, sizeof(communicator));
-  push_data(&e, &msgTag, sizeof(msgTag));
-  push_data(&e, &msgLength, sizeof(msgLength));
-  push_data(&e, &requestID, sizeof(requestID));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiIsendRecord{receiver, communicator, msgTag, msgLength, requestID});
 }
 
 void htf_record_mpi_isend_complete(htf::ThreadWriter* thread_writer,
                                    struct htf::AttributeList* attribute_list __attribute__((unused)),
                                    htf_timestamp_t time,
                                    uint64_t requestID) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_ISEND_COMPLETE);
-
-  push_data(&e, &requestID, sizeof(requestID));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiIsendCompleteRecord{requestID});
 }
 
 void htf_record_mpi_irecv_request(htf::ThreadWriter* thread_writer,
                                   struct htf::AttributeList* attribute_list __attribute__((unused)),
                                   htf_timestamp_t time,
                                   uint64_t requestID) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_IRECV_REQUEST);
-
-  push_data(&e, &requestID, sizeof(requestID));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiIrecvRequestRecord{requestID});
 }
 
 void htf_record_mpi_recv(htf::ThreadWriter* thread_writer,
@@ -1011,23 +1869,7 @@ void htf_record_mpi_recv(htf::ThreadWriter* thread_writer,
                          uint32_t communicator,
                          uint32_t msgTag,
                          uint64_t msgLength) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_RECV);
-
-  push_data(&e, &sender, sizeof(sender));
-  push_data(&e, &communicator, sizeof(communicator));
-  push_data(&e, &msgTag, sizeof(msgTag));
-  push_data(&e, &msgLength, sizeof(msgLength));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiRecvRecord{sender, communicator, msgTag, msgLength});
 }
 
 void htf_record_mpi_irecv(htf::ThreadWriter* thread_writer,
@@ -1038,41 +1880,13 @@ void htf_record_mpi_irecv(htf::ThreadWriter* thread_writer,
                           uint32_t msgTag,
                           uint64_t msgLength,
                           uint64_t requestID) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_IRECV);
-
-  push_data(&e, &sender, sizeof(sender));
-  push_data(&e, &communicator, sizeof(communicator));
-  push_data(&e, &msgTag, sizeof(msgTag));
-  push_data(&e, &msgLength, sizeof(msgLength));
-  push_data(&e, &requestID, sizeof(requestID));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiIrecvRecord{sender, communicator, msgTag, msgLength, requestID});
 }
 
 void htf_record_mpi_collective_begin(htf::ThreadWriter* thread_writer,
                                      struct htf::AttributeList* attribute_list __attribute__((unused)),
                                      htf_timestamp_t time) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_COLLECTIVE_BEGIN);
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
-  return;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiCollectiveBeginRecord{});
 }
 
 void htf_record_mpi_collective_end(htf::ThreadWriter* thread_writer,
@@ -1083,23 +1897,7 @@ void htf_record_mpi_collective_end(htf::ThreadWriter* thread_writer,
                                    uint32_t root,
                                    uint64_t sizeSent,
                                    uint64_t sizeReceived) {
-  if (htf_recursion_shield)
-    return;
-  htf_recursion_shield++;
-
-  htf::Event e;
-  init_event(&e, htf::HTF_EVENT_MPI_COLLECTIVE_END);
-
-  push_data(&e, &collectiveOp, sizeof(collectiveOp));
-  push_data(&e, &communicator, sizeof(communicator));
-  push_data(&e, &root, sizeof(root));
-  push_data(&e, &sizeSent, sizeof(sizeSent));
-  push_data(&e, &sizeReceived, sizeof(sizeReceived));
-
-  htf::TokenId e_id = thread_writer->thread_trace.getEventId(&e);
-  thread_writer->storeEvent(htf::HTF_SINGLETON, e_id, time, attribute_list);
-
-  htf_recursion_shield--;
+  _htf_record(thread_writer, attribute_list, time, htf::MpiCollectiveEndRecord{collectiveOp, communicator, root, sizeSent, sizeReceived});
 }
 
 /* -*-
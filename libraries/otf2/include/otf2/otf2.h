@@ -38,6 +38,11 @@ struct OTF2_EvtWriter_struct {
   OTF2_LocationRef locationRef;
   struct Archive* archive;
   struct ThreadWriter* thread_writer;
+
+  /* Event handles of the Enter and Leave of each region, registered on first use.
+   * region_events[2*region] is the Enter, region_events[2*region+1] is the Leave. */
+  TokenId* region_events;
+  int nb_region_events;
 };
 
 struct OTF2_Archive_struct {
@@ -197,6 +197,8 @@ int new_location(OTF2_Archive* archive, OTF2_LocationRef location) {
   archive->evt_writers[index]->locationRef = location;
   archive->evt_writers[index]->archive = archive->archive;
   archive->evt_writers[index]->thread_writer = archive->def_writers[index]->thread_writer;
+  archive->evt_writers[index]->region_events = NULL;
+  archive->evt_writers[index]->nb_region_events = 0;
   return index;
 }
 
@@ -36,7 +36,33 @@ OTF2_ErrorCode OTF2_EvtWriter_MeasurementOnOff(OTF2_EvtWriter* writer,
                                                OTF2_AttributeList* attributeList,
                                                OTF2_TimeStamp time,
                                                OTF2_MeasurementMode measurementMode) {
-  NOT_IMPLEMENTED;
+  if (measurementMode == OTF2_MEASUREMENT_OFF)
+    htf_measurement_off(writer->thread_writer, time);
+  else
+    htf_measurement_on(writer->thread_writer, time);
+  return OTF2_SUCCESS;
+}
+
+/* Returns the event handle of an Enter or a Leave of region, and registers it if needed */
+static TokenId _get_region_event(OTF2_EvtWriter* writer, enum Record record, OTF2_RegionRef region) {
+  int index = 2 * region + (record == HTF_EVENT_LEAVE);
+  if (index >= writer->nb_region_events) {
+    int new_size = writer->nb_region_events ? writer->nb_region_events : 64;
+    while (new_size <= index)
+      new_size *= 2;
+    writer->region_events =
+        htf_realloc(writer->region_events, writer->nb_region_events, new_size, sizeof(TokenId));
+    for (int i = writer->nb_region_events; i < new_size; i++)
+      writer->region_events[i] = HTF_TOKEN_ID_INVALID;
+    writer->nb_region_events = new_size;
+  }
+
+  if (writer->region_events[index] == HTF_TOKEN_ID_INVALID) {
+    RegionRef region_ref = region;
+    writer->region_events[index] =
+        htf_register_event_template(writer->thread_writer, record, &region_ref, sizeof(region_ref));
+  }
+  return writer->region_events[index];
 }
 
 OTF2_ErrorCode OTF2_EvtWriter_Enter(OTF2_EvtWriter* writer,
@@ -44,9 +70,8 @@ OTF2_ErrorCode OTF2_EvtWriter_Enter(OTF2_EvtWriter* writer,
                                     OTF2_TimeStamp time,
                                     OTF2_RegionRef region) {
   htf_log(Debug, "enter(%p {.locationRef=%lu, .writer=%p}, %d)\n", writer, writer->locationRef, writer->thread_writer, region);
-  htf_record_enter(writer->thread_writer,
-                   attributeList,
-                   time, region);
+  htf_record_event_by_id(writer->thread_writer, _get_region_event(writer, HTF_EVENT_ENTER, region), time,
+                         attributeList);
 
   return OTF2_SUCCESS;
 }
@@ -56,9 +81,8 @@ OTF2_ErrorCode OTF2_EvtWriter_Leave(OTF2_EvtWriter* writer,
                                     OTF2_TimeStamp time,
                                     OTF2_RegionRef region) {
   htf_log(Debug, "leave(%p {.locationRef=%lu, .writer=%p}, %d)\n", writer, writer->locationRef, writer->thread_writer, region);
-  htf_record_leave(writer->thread_writer,
-                   attributeList,
-                   time, region);
+  htf_record_event_by_id(writer->thread_writer, _get_region_event(writer, HTF_EVENT_LEAVE, region), time,
+                         attributeList);
   return OTF2_SUCCESS;
 }
 
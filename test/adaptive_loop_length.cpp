@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records Loops that are longer than the initial maximum loop length, and a function in which no Loop is found.
+ *
+ * With HTF_LOOP_LENGTH=100 and HTF_ADAPTIVE_LOOP_LENGTH=1, the maximum loop length of the main Sequence grows as long
+ * Loops are found, so that a Loop of 150 calls is found. It shrinks in the function that has no Loop.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static htf_timestamp_t ts = 1;
+
+/** Records a call to the given Region, that calls nothing else. */
+static void call(ThreadWriter* thread_writer, RegionRef region) {
+  htf_record_enter(thread_writer, nullptr, ts++, region);
+  htf_record_leave(thread_writer, nullptr, ts++, region);
+}
+
+/** Records `nb_iterations` times the calls to the `nb_regions` Regions starting at `first_region`. */
+static void loop(ThreadWriter* thread_writer, RegionRef first_region, int nb_regions, int nb_iterations) {
+  for (int i = 0; i < nb_iterations; i++) {
+    for (int j = 0; j < nb_regions; j++)
+      call(thread_writer, first_region + j);
+  }
+}
+
+/** Returns whether the Thread has a Loop that repeats a Sequence of `length` tokens. */
+static bool has_loop_of_length(Thread* thread, size_t length) {
+  for (unsigned i = 0; i < thread->nb_loops; i++) {
+    if (thread->getSequence(thread->loops[i].repeated_token)->size() == length)
+      return true;
+  }
+  return false;
+}
+
+int main(int argc, char** argv) {
+  int nb_noise_calls = argc > 1 ? atoi(argv[1]) : 3000;
+  const RegionRef short_loop = 0;
+  const RegionRef long_loop = short_loop + 60;
+  const RegionRef noise = long_loop + 150;
+  const RegionRef noise_calls = noise + 1;
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "adaptive_loop_length_trace", "main");
+  htf_write_archive_open(archive, "adaptive_loop_length_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "function");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  for (RegionRef r = 0; r < noise_calls + nb_noise_calls; r++)
+    htf_archive_register_region(archive, r, 2);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  // A Loop of 60 calls is found with the initial maximum loop length, which then grows.
+  loop(thread_writer, short_loop, 60, 3);
+  // A Loop of 150 calls would be missed without the adaptive loop length.
+  loop(thread_writer, long_loop, 150, 3);
+  // No Loop is found in this function.
+  htf_record_enter(thread_writer, nullptr, ts++, noise);
+  loop(thread_writer, noise_calls, nb_noise_calls, 1);
+  htf_record_leave(thread_writer, nullptr, ts++, noise);
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "adaptive_loop_length_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+
+  htf_assert(has_loop_of_length(thread, 60));
+  htf_assert(has_loop_of_length(thread, 150));
+  // The main Sequence, the noise function, and the calls.
+  htf_assert(thread->nb_max_loop_lengths == 3);
+  htf_assert(thread->max_loop_lengths[0] == 400);
+  htf_assert(thread->max_loop_lengths[1] < 100);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records many short calls to a Region, which end up aggregated, and a few longer calls that do not.
+ *
+ * With HTF_AGGREGATION_MIN_RATE=100000 and HTF_AGGREGATION_MAX_DURATION=100, the calls to tiny are aggregated once
+ * a window of them was observed, except for the last one, which calls slow. The calls to slow are all recorded.
+ *
+ * The optional second argument is the number of nanoseconds per tick of the timestamps. With as many iterations
+ * as CallAggregator::window_size, tiny is aggregated but no call is, so min_duration is never set.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static int nb_iterations_default = 10000;
+
+enum { TINY, SLOW };
+
+/** Returns the EventSummary of the Enter or the Leave of a Region. */
+static EventSummary* get_event_summary(Thread* thread, enum Record record, RegionRef region) {
+  for (unsigned i = 0; i < thread->nb_events; i++) {
+    EventSummary* es = &thread->events[i];
+    RegionRef region_ref;
+    memcpy(&region_ref, es->event.event_data, sizeof(region_ref));
+    if (es->event.record == record && region_ref == region)
+      return es;
+  }
+  htf_error("Event not found\n");
+}
+
+int main(int argc, char** argv) {
+  int nb_iterations = argc > 1 ? atoi(argv[1]) : nb_iterations_default;
+  double ns_per_tick = argc > 2 ? atof(argv[2]) : 1;
+  if (ns_per_tick != 1) {
+    htf_clock_info_t clock = {static_cast<uint32_t>(ClockSource::TSC), ns_per_tick, ns_per_tick};
+    htf_set_clock_info(&clock);
+  }
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "aggregated_calls_trace", "main");
+  htf_write_archive_open(archive, "aggregated_calls_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "tiny");
+  htf_archive_register_string(global_archive, 3, "slow");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  htf_archive_register_region(archive, TINY, 2);
+  htf_archive_register_region(archive, SLOW, 3);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  htf_timestamp_t ts = 1;
+  htf_timestamp_t first_ts = ts;
+  for (int i = 0; i < nb_iterations; i++) {
+    htf_record_enter(thread_writer, nullptr, ts, TINY);
+    htf_record_leave(thread_writer, nullptr, ts + 10, TINY);
+    htf_record_enter(thread_writer, nullptr, ts + 20, SLOW);
+    htf_record_leave(thread_writer, nullptr, ts + 1020, SLOW);
+    ts += 1030;
+  }
+  // This call to tiny calls slow: it is recorded even though tiny is aggregated.
+  htf_record_enter(thread_writer, nullptr, ts, TINY);
+  htf_record_enter(thread_writer, nullptr, ts + 10, SLOW);
+  htf_record_leave(thread_writer, nullptr, ts + 1010, SLOW);
+  htf_record_leave(thread_writer, nullptr, ts + 1020, TINY);
+  htf_timestamp_t last_ts = ts + 1020;
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "aggregated_calls_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+
+  size_t nb_recorded_calls = CallAggregator::window_size;
+  size_t nb_aggregated_calls = nb_iterations - nb_recorded_calls;
+  auto tiny_duration = static_cast<htf_timestamp_t>(10 * ns_per_tick);
+  EventSummary* enter_tiny = get_event_summary(thread, HTF_EVENT_ENTER, TINY);
+  htf_assert(enter_tiny->aggregated_calls);
+  htf_assert(enter_tiny->nb_occurences == nb_recorded_calls + 1);
+  htf_assert(enter_tiny->aggregated_calls->nb_calls == nb_aggregated_calls);
+  htf_assert(enter_tiny->aggregated_calls->total_duration == tiny_duration * nb_aggregated_calls);
+  htf_assert(enter_tiny->aggregated_calls->min_duration == (nb_aggregated_calls ? tiny_duration : 0));
+  htf_assert(enter_tiny->aggregated_calls->max_duration == (nb_aggregated_calls ? tiny_duration : 0));
+  htf_assert(get_event_summary(thread, HTF_EVENT_LEAVE, TINY)->nb_occurences == nb_recorded_calls + 1);
+
+  EventSummary* enter_slow = get_event_summary(thread, HTF_EVENT_ENTER, SLOW);
+  htf_assert(!enter_slow->aggregated_calls);
+  htf_assert(enter_slow->nb_occurences == (size_t)nb_iterations + 1);
+
+  // The time of the aggregated calls is part of the durations of the Events before them.
+  htf_timestamp_t total_duration = 0;
+  for (unsigned i = 0; i < thread->nb_events; i++) {
+    for (auto d : *thread->events[i].durations)
+      total_duration += d;
+  }
+  htf_assert(total_duration == static_cast<htf_timestamp_t>((last_ts - first_ts) * ns_per_tick));
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
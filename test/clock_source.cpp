@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records calls timestamped by the clock chosen with HTF_CLOCK, and reads their durations back.
+ *
+ * The clock may count in ticks that are not nanoseconds, such as the TSC: the durations read back must still be in
+ * nanoseconds, between the time measured inside the call and the time measured around it.
+ */
+#include <time.h>
+#include <cstdlib>
+#include <string>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_parameter_handler.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static const RegionRef sleep_region = 0;
+/** Relative error allowed on the durations, for the calibration of the clock. */
+static const double tolerance = 0.02;
+
+static htf_timestamp_t now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+  return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+  int nb_calls = argc > 1 ? atoi(argv[1]) : 20;
+  htf_timestamp_t* inner = new htf_timestamp_t[nb_calls];
+  htf_timestamp_t* outer = new htf_timestamp_t[nb_calls];
+
+  // Each clock has its own trace, so that the tests of the clocks can run at the same time.
+  ClockSource source = parameterHandler.getClockSource();
+  std::string dir_name = "clock_" + algorithmToString(source) + "_trace";
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, dir_name.c_str(), "main");
+  htf_write_archive_open(archive, dir_name.c_str(), "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "sleep");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  htf_archive_register_region(archive, sleep_region, 2);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  for (int i = 0; i < nb_calls; i++) {
+    // Each call sleeps for a different time, so that the calls are not aggregated in a single duration.
+    struct timespec wait = {0, 1000000 + 100000 * i};
+    htf_timestamp_t t1 = now();
+    htf_record_enter(thread_writer, nullptr, HTF_TIMESTAMP_INVALID, sleep_region);
+    htf_timestamp_t t2 = now();
+    nanosleep(&wait, nullptr);
+    htf_timestamp_t t3 = now();
+    htf_record_leave(thread_writer, nullptr, HTF_TIMESTAMP_INVALID, sleep_region);
+    htf_timestamp_t t4 = now();
+    inner[i] = t3 - t2;
+    outer[i] = t4 - t1;
+  }
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  std::string trace_name = dir_name + "/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name.data());
+  htf_clock_info_t clock = trace.clock;
+  htf_log(DebugLevel::Normal, "Read a trace of clock %u {.resolution=%lf ns, .ns_per_tick=%lf}\n", clock.source,
+          clock.resolution, clock.ns_per_tick);
+  // Without an invariant TSC, CLOCK_MONOTONIC_RAW is used instead.
+  if (source == ClockSource::TSC && clock.source != static_cast<uint32_t>(ClockSource::TSC))
+    source = ClockSource::MonotonicRaw;
+  htf_assert(clock.source == static_cast<uint32_t>(source));
+
+  Thread* thread = trace.threads[0];
+  auto reader = ThreadReader(&trace, thread->id, ThreadReaderOptions::None);
+  int nb_enters = 0;
+  while (reader.current_frame >= 0) {
+    Token token = reader.getCurToken();
+    Occurence* occurence = reader.getOccurence(token, reader.tokenCount[token]);
+    reader.updateReadCurToken();
+    if (token.type != TypeEvent)
+      continue;
+    reader.moveToNextToken();
+
+    EventOccurence* e = &occurence->event_occurence;
+    if (e->event->record != HTF_EVENT_ENTER)
+      continue;
+    double margin = tolerance * outer[nb_enters] + clock.resolution;
+    htf_assert(e->duration + margin >= inner[nb_enters]);
+    htf_assert(e->duration <= outer[nb_enters] + margin);
+    nb_enters++;
+  }
+  htf_assert(nb_enters == nb_calls);
+  delete[] inner;
+  delete[] outer;
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,77 @@
+#!/bin/bash
+
+CUR_PATH=$(dirname  $(realpath $0))
+source "$CUR_PATH/test_utils.sh"
+
+BUILD_DIR=$CUR_PATH
+
+if [ $# -gt 0 ]; then
+    BUILD_DIR=$1
+fi
+
+[ -n "$HTF_COLLECTOR_PATH" ] || export HTF_COLLECTOR_PATH=htf_collector
+
+nb_failed=0
+nb_pass=0
+
+test_program="write_benchmark"
+niter=20
+nthread=4
+
+# The application sends its events to a collector process, which writes the trace
+export HTF_COLLECTOR="htf_collector_test_$$"
+
+cd "$BUILD_DIR"
+trace_filename="${test_program}_trace/main.htf"
+
+# Runs the collector while the command runs, and waits for it to write the trace
+function run_with_collector {
+    rm -rf "${test_program}_trace"
+    # The collector waits for the application forever: do not hang if it failed to start
+    timeout 60 "$HTF_COLLECTOR_PATH" "$HTF_COLLECTOR" > /dev/null 2>&1 &
+    collector_pid=$!
+    "$@" > /dev/null 2>&1
+    wait $collector_pid
+    if [ "$?" != "0" ]; then
+	print_error "htf_collector failed"
+	((nb_failed++))
+	return 1
+    fi
+    return 0
+}
+
+echo "> Running ./${test_program} -n $niter -t $nthread with a collector"
+run_with_collector "./${test_program}" -n $niter -t $nthread
+
+trace_check_existence "$trace_filename"
+trace_check_htf_print "$trace_filename"
+trace_check_enter_leave_parity "$trace_filename"
+trace_check_nb_function "$trace_filename" function_0 $(expr $niter \* $nthread)
+trace_check_nb_function "$trace_filename" function_1 $(expr $niter \* $nthread)
+
+# The application crashes before closing the trace: the collector still writes everything it recorded
+echo "> Running ./${test_program} -n $niter -t $nthread -k with a collector"
+run_with_collector env HTF_CLOCK=MonotonicRaw "./${test_program}" -n $niter -t $nthread -k
+
+trace_check_existence "$trace_filename"
+trace_check_htf_print "$trace_filename"
+trace_check_enter_leave_parity "$trace_filename"
+trace_check_nb_function "$trace_filename" function_0 $(expr $niter \* $nthread)
+trace_check_nb_function "$trace_filename" function_1 $(expr $niter \* $nthread)
+
+# The clock of the application is known to the collector even though the archives were never closed
+echo " > Checking that the trace has the clock of the application"
+if "$HTF_INFO_PATH" "$trace_filename" 2>/dev/null | grep -q "source: MonotonicRaw"; then
+    ((nb_pass++))
+    print_ok
+else
+    print_error "The trace does not have the clock of the application"
+    ((nb_failed++))
+fi
+
+echo "results: $nb_pass pass, $nb_failed failed"
+if [ $nb_failed -gt 0 ]; then
+    exit 1;
+else
+    exit 0;
+fi
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records more distinct Events, Sequences and attributes than the limits allow.
+ *
+ * With HTF_MAX_EVENTS=50, HTF_MAX_SEQUENCES=20 and HTF_MAX_ATTRIBUTE_BUFFER_SIZE=1024, the Thread switches to
+ * the cheaper recording modes. Reading the trace back must still give every call, and every message tag.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+int main(int argc, char** argv) {
+  int nb_calls = argc > 1 ? atoi(argv[1]) : 100;
+  const RegionRef attribute_region = nb_calls;
+  const AttributeRef attribute = 0;
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "dictionary_limits_trace", "main");
+  htf_write_archive_open(archive, "dictionary_limits_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "function");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  for (RegionRef r = 0; r <= attribute_region; r++)
+    htf_archive_register_region(archive, r, 2);
+  htf_archive_register_attribute(archive, attribute, 2, 2, HTF_TYPE_UINT64);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  htf_timestamp_t ts = 1;
+  // Each message tag is a distinct Event, until the tags are stored per occurence.
+  for (int i = 0; i < nb_calls; i++)
+    htf_record_mpi_send(thread_writer, nullptr, ts++, 1, 0, i, 8);
+  // Each Region is a distinct Sequence, until the calls are stored as a flat stream.
+  for (int i = 0; i < nb_calls; i++) {
+    htf_record_enter(thread_writer, nullptr, ts++, i);
+    htf_record_leave(thread_writer, nullptr, ts++, i);
+  }
+  // The attributes of the Enter fill its buffer, the next ones are dropped.
+  for (int i = 0; i < nb_calls; i++) {
+    AttributeList attribute_list;
+    htf_attribute_list_init(&attribute_list);
+    AttributeValue value;
+    value.uint64 = i;
+    htf_attribute_list_add_attribute(&attribute_list, attribute, sizeof(value.uint64), value);
+    htf_record_enter(thread_writer, &attribute_list, ts++, attribute_region);
+    htf_record_leave(thread_writer, nullptr, ts++, attribute_region);
+  }
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "dictionary_limits_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+  htf_assert(thread->degradations == (HTF_DEGRADATION_FLAT_SEQUENCES | HTF_DEGRADATION_PAYLOAD_COLUMNS |
+                                      HTF_DEGRADATION_DROPPED_ATTRIBUTES));
+  htf_assert(thread->nb_sequences <= 20);
+  htf_assert(thread->nb_dropped_attributes > 0);
+
+  auto reader = ThreadReader(&trace, thread->id, ThreadReaderOptions::None);
+  int nb_sends = 0;
+  int nb_enters = 0;
+  int nb_leaves = 0;
+  size_t nb_attribute_lists = 0;
+  while (reader.current_frame >= 0) {
+    Token token = reader.getCurToken();
+    Occurence* occurence = reader.getOccurence(token, reader.tokenCount[token]);
+    reader.updateReadCurToken();
+    if (token.type != TypeEvent)
+      continue;
+    reader.moveToNextToken();
+
+    EventOccurence* e = &occurence->event_occurence;
+    Event event = *e->event;
+    uint32_t volatile_fields = reader.thread_trace->getEventSummary(token)->volatile_fields;
+    if (volatile_fields)
+      restoreVolatileFields(&event, volatile_fields, e->volatile_values);
+    switch (event.record) {
+    case HTF_EVENT_MPI_SEND: {
+      auto payload = decodeEvent<MpiSendRecord>(&event);
+      htf_assert(payload.msgTag == (uint32_t)nb_sends);
+      nb_sends++;
+      break;
+    }
+    case HTF_EVENT_ENTER: {
+      auto payload = decodeEvent<EnterRecord>(&event);
+      if (payload.region_ref == attribute_region && e->attributes) {
+        htf_assert(e->attributes->attributes[0].value.uint64 == nb_attribute_lists);
+        nb_attribute_lists++;
+      }
+      nb_enters++;
+      break;
+    }
+    case HTF_EVENT_LEAVE:
+      nb_leaves++;
+      break;
+    default:
+      htf_error("Unexpected event %d\n", event.record);
+    }
+  }
+  htf_assert(nb_sends == nb_calls);
+  htf_assert(nb_enters == 2 * nb_calls && nb_leaves == 2 * nb_calls);
+  htf_assert(nb_attribute_lists + thread->nb_dropped_attributes == (size_t)nb_calls);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records the calls of a Region through cached Event handles, mixed with calls recorded with htf_record_enter and
+ * htf_record_leave.
+ *
+ * The handles must be the ids of the Events that htf_record_enter and htf_record_leave store: the trace then holds
+ * a single Enter and a single Leave, with the occurences of both ways of recording them.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static const RegionRef compute_region = 0;
+
+int main(int argc, char** argv) {
+  int nb_calls = argc > 1 ? atoi(argv[1]) : 100;
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "event_handles_trace", "main");
+  htf_write_archive_open(archive, "event_handles_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "compute");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  htf_archive_register_region(archive, compute_region, 2);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  htf_timestamp_t ts = 1;
+  htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+
+  // The Events already exist: registering them must give their ids, and create nothing.
+  auto nb_events = thread_writer->thread_trace.nb_events;
+  EnterRecord enter{compute_region};
+  LeaveRecord leave{compute_region};
+  TokenId enter_id = htf_register_event_template(thread_writer, HTF_EVENT_ENTER, &enter, sizeof(enter));
+  TokenId leave_id = htf_register_event_template(thread_writer, HTF_EVENT_LEAVE, &leave, sizeof(leave));
+  htf_assert(thread_writer->thread_trace.nb_events == nb_events);
+  htf_assert(enter_id != leave_id);
+
+  for (int i = 1; i < nb_calls; i++) {
+    if (i % 2) {
+      htf_record_event_by_id(thread_writer, enter_id, ts++, nullptr);
+      htf_record_event_by_id(thread_writer, leave_id, ts++, nullptr);
+    } else {
+      htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+      htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+    }
+  }
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "event_handles_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+
+  auto enters = decodeEvents<EnterRecord>(thread);
+  auto leaves = decodeEvents<LeaveRecord>(thread);
+  htf_assert(enters.size() == 1 && leaves.size() == 1);
+  htf_assert(enters[0].first == enter_id && enters[0].second.region_ref == compute_region);
+  htf_assert(leaves[0].first == leave_id && leaves[0].second.region_ref == compute_region);
+  htf_assert(thread->events[enter_id].nb_occurences == (size_t)nb_calls);
+  htf_assert(thread->events[leave_id].nb_occurences == (size_t)nb_calls);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Suspends and resumes the recording between timesteps, and in the middle of them.
+ *
+ * The Events recorded while the recording is suspended are dropped, and MeasurementOnOff markers show the gaps.
+ * The calls that start or end during a gap must not shift the next Events to another level of the callstack.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static htf_timestamp_t ts = 1;
+static const RegionRef timestep_region = 0;
+static const RegionRef compute_region = 1;
+
+/** Records `nb_timesteps` timesteps, that each call compute. */
+static void timesteps(ThreadWriter* thread_writer, int nb_timesteps) {
+  for (int i = 0; i < nb_timesteps; i++) {
+    htf_record_enter(thread_writer, nullptr, ts++, timestep_region);
+    htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+    htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+    htf_record_leave(thread_writer, nullptr, ts++, timestep_region);
+  }
+}
+
+/** Returns the number of occurences of the Events of the Thread that match `r`. */
+template <class R, class F>
+static int count_occurences(Thread* thread, F&& match) {
+  int n = 0;
+  for (auto& [id, payload] : decodeEvents<R>(thread)) {
+    if (match(payload))
+      n += thread->events[id].nb_occurences;
+  }
+  return n;
+}
+
+int main(int argc, char** argv) {
+  int nb_timesteps = argc > 1 ? atoi(argv[1]) : 10;
+  // The depth of the callstack is only known right away when the Events are stored synchronously, in order.
+  bool check_depth = !parameterHandler.getAsyncRecording() && !parameterHandler.getReorderWindow() &&
+                     !parameterHandler.getReorderBufferSize();
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "measurement_on_off_trace", "main");
+  htf_write_archive_open(archive, "measurement_on_off_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "timestep");
+  htf_archive_register_string(global_archive, 3, "compute");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  htf_archive_register_region(archive, timestep_region, 2);
+  htf_archive_register_region(archive, compute_region, 3);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  timesteps(thread_writer, nb_timesteps);
+
+  // A gap between two timesteps.
+  htf_measurement_off(thread_writer, ts++);
+  timesteps(thread_writer, nb_timesteps);
+  htf_measurement_on(thread_writer, ts++);
+  timesteps(thread_writer, nb_timesteps);
+
+  // A gap that starts in compute: the timestep and compute end during the gap.
+  htf_record_enter(thread_writer, nullptr, ts++, timestep_region);
+  htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+  htf_measurement_off(thread_writer, ts++);
+  htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, timestep_region);
+  timesteps(thread_writer, nb_timesteps);
+  htf_measurement_on(thread_writer, ts++);
+  htf_assert(!check_depth || thread_writer->cur_depth == 0);
+  timesteps(thread_writer, nb_timesteps);
+
+  // A gap that ends in a timestep, that started during the gap.
+  htf_measurement_off(thread_writer, ts++);
+  timesteps(thread_writer, nb_timesteps);
+  htf_record_enter(thread_writer, nullptr, ts++, timestep_region);
+  htf_measurement_on(thread_writer, ts++);
+  htf_assert(!check_depth || thread_writer->cur_depth == 1);
+  htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, timestep_region);
+  htf_assert(!check_depth || thread_writer->cur_depth == 0);
+  timesteps(thread_writer, nb_timesteps);
+
+  // A gap that leaves compute and its timestep, then enters another timestep: the resumed Events belong to the new
+  // timestep, not to the one that ended during the gap.
+  htf_record_enter(thread_writer, nullptr, ts++, timestep_region);
+  htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+  htf_measurement_off(thread_writer, ts++);
+  htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, timestep_region);
+  timesteps(thread_writer, nb_timesteps);
+  htf_record_enter(thread_writer, nullptr, ts++, timestep_region);
+  htf_measurement_on(thread_writer, ts++);
+  htf_assert(!check_depth || thread_writer->cur_depth == 1);
+  htf_record_enter(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, compute_region);
+  htf_record_leave(thread_writer, nullptr, ts++, timestep_region);
+  htf_assert(!check_depth || thread_writer->cur_depth == 0);
+  timesteps(thread_writer, nb_timesteps);
+
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "measurement_on_off_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+
+  auto is_off = [](const MeasurementOnOffRecord& r) { return r.measurementMode == HTF_MEASUREMENT_OFF; };
+  auto is_on = [](const MeasurementOnOffRecord& r) { return r.measurementMode == HTF_MEASUREMENT_ON; };
+  htf_assert(count_occurences<MeasurementOnOffRecord>(thread, is_off) == 4);
+  // The gaps that end above where they started end the calls they left with an ON marker, and the last one also
+  // starts the timestep it entered with an ON marker.
+  htf_assert(count_occurences<MeasurementOnOffRecord>(thread, is_on) == 7);
+
+  auto is_timestep = [](auto& r) { return r.region_ref == timestep_region; };
+  auto is_compute = [](auto& r) { return r.region_ref == compute_region; };
+  htf_assert(count_occurences<EnterRecord>(thread, is_timestep) == 5 * nb_timesteps + 2);
+  htf_assert(count_occurences<LeaveRecord>(thread, is_timestep) == 5 * nb_timesteps + 2);
+  htf_assert(count_occurences<EnterRecord>(thread, is_compute) == 5 * nb_timesteps + 4);
+  htf_assert(count_occurences<LeaveRecord>(thread, is_compute) == 5 * nb_timesteps + 2);
+  // The timesteps after the gaps are still recognized as the same Sequence.
+  htf_assert(thread->nb_loops > 0);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records an outer iteration (setup, a varying number of calls to iterate, check) many times.
+ *
+ * With HTF_PARAMETRIC_LOOPS=1, the calls to iterate always form the same Loop, even when there is
+ * a single one, so all the outer iterations are the same Sequence, and they form a Loop.
+ * Reading the trace back must still give every event at its timestamp.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_parameter_handler.h"
+#include "htf/htf_read.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static int nb_iterations_default = 100;
+
+enum { SOLVE, SETUP, ITERATE, CHECK };
+
+static int nb_trips(int i) {
+  return 1 + (i + 1) % 3;
+}
+
+int main(int argc, char** argv) {
+  int nb_iterations = argc > 1 ? atoi(argv[1]) : nb_iterations_default;
+  htf_assert(parameterHandler.getParametricLoops());
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "parametric_loops_trace", "main");
+  htf_write_archive_open(archive, "parametric_loops_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  for (int region = SOLVE; region <= CHECK; region++) {
+    htf_archive_register_string(archive, region + 2, "region");
+    htf_archive_register_region(archive, region, region + 2);
+  }
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  htf_timestamp_t ts = 1;
+  htf_record_enter(thread_writer, nullptr, ts++, SOLVE);
+  for (int i = 0; i < nb_iterations; i++) {
+    htf_record_enter(thread_writer, nullptr, ts++, SETUP);
+    htf_record_leave(thread_writer, nullptr, ts++, SETUP);
+    for (int j = 0; j < nb_trips(i); j++) {
+      htf_record_enter(thread_writer, nullptr, ts++, ITERATE);
+      htf_record_leave(thread_writer, nullptr, ts++, ITERATE);
+    }
+    htf_record_enter(thread_writer, nullptr, ts++, CHECK);
+    htf_record_leave(thread_writer, nullptr, ts++, CHECK);
+  }
+  htf_record_leave(thread_writer, nullptr, ts++, SOLVE);
+
+  /* One Loop for the calls to iterate, and one for the outer iterations. */
+  htf_assert(thread_writer->thread_trace.nb_loops == 2);
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  /* Each event comes back at its own timestamp, relative to the first one. */
+  char trace_name[] = "parametric_loops_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  auto reader = ThreadReader(&trace, trace.threads[0]->id, ThreadReaderOptions::None);
+  htf_timestamp_t expected_ts = 0;
+  while (reader.current_frame >= 0) {
+    Token token = reader.getCurToken();
+    Occurence* occurence = reader.getOccurence(token, reader.tokenCount[token]);
+    reader.updateReadCurToken();
+    if (token.type == TypeEvent) {
+      reader.moveToNextToken();
+      htf_assert(occurence->event_occurence.timestamp == expected_ts);
+      expected_ts++;
+    }
+    delete occurence;
+  }
+  htf_assert(expected_ts == ts - 1);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records calls to regions, some of which are filtered out.
+ *
+ * With HTF_INCLUDE_REGIONS=compute,tiny_* and HTF_EXCLUDE_REGIONS=tiny_other, only the calls to
+ * compute and tiny_helper are recorded, whether they are recorded directly or through an event template,
+ * and whether the name of the region is registered before or after the region itself.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_filter.h"
+#include "htf/htf_read.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static int nb_iterations_default = 100;
+
+enum { COMPUTE, TINY_HELPER, TINY_OTHER, MPI_COMM_RANK };
+
+int main(int argc, char** argv) {
+  int nb_iterations = argc > 1 ? atoi(argv[1]) : nb_iterations_default;
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "region_filter_trace", "main");
+  htf_write_archive_open(archive, "region_filter_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  /* The names are registered in the global archive, and some of them after their region. */
+  htf_archive_register_string(global_archive, 2, "compute");
+  htf_archive_register_string(global_archive, 3, "tiny_helper");
+  htf_archive_register_region(archive, COMPUTE, 2);
+  htf_archive_register_region(archive, TINY_HELPER, 3);
+  htf_archive_register_region(archive, TINY_OTHER, 4);
+  htf_archive_register_region(archive, MPI_COMM_RANK, 5);
+  htf_archive_register_string(global_archive, 4, "tiny_other");
+  htf_archive_register_string(global_archive, 5, "MPI_Comm_rank");
+
+  htf_assert(!regionFilter.isFiltered(COMPUTE));
+  htf_assert(!regionFilter.isFiltered(TINY_HELPER));
+  htf_assert(regionFilter.isFiltered(TINY_OTHER));
+  htf_assert(regionFilter.isFiltered(MPI_COMM_RANK));
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  RegionRef region = TINY_OTHER;
+  htf_assert(htf_register_event_template(thread_writer, HTF_EVENT_ENTER, &region, sizeof(region)) ==
+             HTF_TOKEN_ID_FILTERED);
+  TokenId enter_other = htf_register_event_template(thread_writer, HTF_EVENT_ENTER, &region, sizeof(region));
+  TokenId leave_other = htf_register_event_template(thread_writer, HTF_EVENT_LEAVE, &region, sizeof(region));
+
+  htf_timestamp_t ts = 1;
+  for (int i = 0; i < nb_iterations; i++) {
+    htf_record_enter(thread_writer, nullptr, ts++, COMPUTE);
+    htf_record_enter(thread_writer, nullptr, ts++, MPI_COMM_RANK);
+    htf_record_leave(thread_writer, nullptr, ts++, MPI_COMM_RANK);
+    htf_record_enter(thread_writer, nullptr, ts++, TINY_HELPER);
+    htf_record_leave(thread_writer, nullptr, ts++, TINY_HELPER);
+    htf_record_event_by_id(thread_writer, enter_other, ts++, nullptr);
+    htf_record_event_by_id(thread_writer, leave_other, ts++, nullptr);
+    htf_record_leave(thread_writer, nullptr, ts++, COMPUTE);
+  }
+
+  /* Only the enters and leaves of compute and tiny_helper are Events. */
+  htf_assert(thread_writer->thread_trace.nb_events == 4);
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "region_filter_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+  for (unsigned i = 0; i < thread->nb_events; i++) {
+    EventSummary* es = &thread->events[i];
+    RegionRef region_ref;
+    memcpy(&region_ref, es->event.event_data, sizeof(region_ref));
+    htf_assert(region_ref == COMPUTE || region_ref == TINY_HELPER);
+    htf_assert(es->nb_occurences == (size_t)nb_iterations);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records the calls of a thread out of order, as a source that delivers its Events late would.
+ *
+ * The calls are recorded by blocks, from the last Event of a block to its first one: the reorder buffer must store
+ * them sorted by timestamp. A last call is recorded long after its time: it is counted as late.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static const int block_size = 4;
+static const htf_timestamp_t period = 100;
+static const htf_timestamp_t duration = 10;
+static const RegionRef kernel_region = 0;
+
+int main(int argc, char** argv) {
+  int nb_blocks = argc > 1 ? atoi(argv[1]) : 100;
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "reorder_events_trace", "main");
+  htf_write_archive_open(archive, "reorder_events_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_archive_register_string(global_archive, 2, "kernel");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+  htf_archive_register_region(archive, kernel_region, 2);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  for (int b = 0; b < nb_blocks; b++) {
+    for (int k = block_size; k-- > 0;) {
+      htf_timestamp_t start = 1000 + (b * block_size + k) * period;
+      htf_record_leave(thread_writer, nullptr, start + duration, kernel_region);
+      htf_record_enter(thread_writer, nullptr, start, kernel_region);
+    }
+  }
+  // Arrives after the Events that followed it were stored.
+  htf_record_enter(thread_writer, nullptr, 1000, kernel_region);
+  htf_record_leave(thread_writer, nullptr, 1000 + duration, kernel_region);
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "reorder_events_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  Thread* thread = trace.threads[0];
+  htf_assert(thread->nb_late_events == 2);
+
+  auto reader = ThreadReader(&trace, thread->id, ThreadReaderOptions::None);
+  int nb_events = 0;
+  int nb_in_time = 0;
+  htf_timestamp_t previous = 0;
+  while (reader.current_frame >= 0) {
+    Token token = reader.getCurToken();
+    Occurence* occurence = reader.getOccurence(token, reader.tokenCount[token]);
+    reader.updateReadCurToken();
+    if (token.type != TypeEvent)
+      continue;
+    reader.moveToNextToken();
+
+    // The timestamps are read relatively to the first Event of the Thread.
+    EventOccurence* e = &occurence->event_occurence;
+    bool is_enter = nb_events % 2 == 0;
+    htf_assert(e->event->record == (is_enter ? HTF_EVENT_ENTER : HTF_EVENT_LEAVE));
+    htf_assert(e->timestamp >= previous);
+    // The late call is stored among the others, with the timestamp of the last Event stored before it.
+    htf_timestamp_t expected = (nb_in_time / 2) * period + (nb_in_time % 2 ? duration : 0);
+    if (e->timestamp == expected && is_enter == (nb_in_time % 2 == 0))
+      nb_in_time++;
+    previous = e->timestamp;
+    nb_events++;
+  }
+  htf_assert(nb_in_time == 2 * nb_blocks * block_size);
+  htf_assert(nb_events == nb_in_time + 2);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
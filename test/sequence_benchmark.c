@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Measures the cost of recording events while the number of distinct sequences grows.
+ *
+ * Each call to function_a contains a call to function_b, so that every (a, b) pair
+ * creates a new sequence. The cost per event is reported for each batch of calls:
+ * it should not depend on the number of sequences already registered. The timings are
+ * only reported: ctest checks the number of sequences, which does not depend on the load
+ * of the machine.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_write.h"
+
+#define TIME_DIFF(t1, t2) (((t2).tv_sec - (t1).tv_sec) + ((t2).tv_nsec - (t1).tv_nsec) / 1e9)
+
+static int nb_functions_default = 100;
+static int nb_batches_default = 10;
+
+int main(int argc, char** argv) {
+  int nb_functions = nb_functions_default;
+  int nb_batches = nb_batches_default;
+
+  if (argc > 1)
+    nb_functions = atoi(argv[1]);
+  if (argc > 2)
+    nb_batches = atoi(argv[2]);
+  if (nb_functions <= 0 || nb_batches <= 0 || nb_functions % nb_batches) {
+    fprintf(stderr, "Usage: %s [nb_functions] [nb_batches]\n", argv[0]);
+    fprintf(stderr, "\tnb_functions (default: %d) must be a multiple of nb_batches (default: %d)\n",
+            nb_functions_default, nb_batches_default);
+    return EXIT_FAILURE;
+  }
+
+  struct Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(archive, "sequence_benchmark_trace", "main");
+  htf_archive_register_string(archive, 0, "Process");
+  htf_archive_register_string(archive, 1, "thread_0");
+  htf_write_define_location_group(archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(archive, 0, 1, 0);
+
+  char region_name[50];
+  for (int i = 0; i < nb_functions; i++) {
+    snprintf(region_name, sizeof(region_name), "function_%d", i);
+    htf_archive_register_string(archive, i + 2, region_name);
+    htf_archive_register_region(archive, i, i + 2);
+  }
+
+  struct ThreadWriter* thread_writer = malloc(sizeof(struct ThreadWriter));
+  htf_write_thread_open(archive, thread_writer, 0);
+
+  int functions_per_batch = nb_functions / nb_batches;
+  int nb_events_per_batch = 4 * functions_per_batch * nb_functions;
+  htf_timestamp_t ts = 1;
+  double first_batch = 0;
+  double last_batch = 0;
+  for (int batch = 0; batch < nb_batches; batch++) {
+    unsigned nb_sequences = thread_writer->thread_trace.nb_sequences;
+    struct timespec t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int a = batch * functions_per_batch; a < (batch + 1) * functions_per_batch; a++) {
+      for (int b = 0; b < nb_functions; b++) {
+        htf_record_enter(thread_writer, NULL, ts++, a);
+        htf_record_enter(thread_writer, NULL, ts++, b);
+        htf_record_leave(thread_writer, NULL, ts++, b);
+        htf_record_leave(thread_writer, NULL, ts++, a);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    double duration_per_event = TIME_DIFF(t1, t2) / nb_events_per_batch;
+    if (batch == 0)
+      first_batch = duration_per_event;
+    last_batch = duration_per_event;
+    printf("batch %d: %u sequences -> %lf ns per event\n", batch, nb_sequences, duration_per_event * 1e9);
+  }
+  printf("last batch / first batch: %lf\n", last_batch / first_batch);
+
+  /* one sequence per (a, b) pair, one per b, and the main sequence */
+  unsigned expected_sequences = nb_functions * nb_functions + nb_functions + 1;
+  htf_assert(thread_writer->thread_trace.nb_sequences == expected_sequences);
+
+  htf_write_thread_close(thread_writer);
+  htf_write_global_archive_close(archive);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
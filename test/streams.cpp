@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records several streams from a single thread, such as the streams of a GPU.
+ *
+ * The kernels of the streams are recorded in turn, so the Events of a stream are interleaved with the Events of the
+ * others. Each stream has its own period and kernel duration: reading the trace back must give the timestamps of
+ * each stream, as if it had been recorded alone.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static const unsigned nb_streams = 8;
+static const RegionRef kernel_region = 0;
+
+/** Start of the first kernel of a stream. */
+static htf_timestamp_t first_start(unsigned stream) {
+  return 1000 + 7 * stream;
+}
+/** Time between the starts of two kernels of a stream. */
+static htf_timestamp_t period(unsigned stream) {
+  return 100 + 10 * stream;
+}
+/** Duration of the kernels of a stream. */
+static htf_timestamp_t kernel_duration(unsigned stream) {
+  return 10 + stream;
+}
+
+int main(int argc, char** argv) {
+  int nb_kernels = argc > 1 ? atoi(argv[1]) : 100;
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "streams_trace", "main");
+  htf_write_archive_open(archive, "streams_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "stream");
+  htf_archive_register_string(global_archive, 2, "kernel");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  for (unsigned s = 0; s < nb_streams; s++)
+    htf_write_define_location(global_archive, s, 1, 0);
+  htf_archive_register_region(archive, kernel_region, 2);
+
+  ThreadWriter* streams = htf_write_streams_open(archive, 0, nb_streams);
+  for (int k = 0; k < nb_kernels; k++) {
+    // The last streams are recorded first, so that the timestamps do not increase from one Event to the next.
+    for (unsigned s = nb_streams; s-- > 0;) {
+      htf_timestamp_t start = first_start(s) + k * period(s);
+      htf_record_enter(&streams[s], nullptr, start, kernel_region);
+      htf_record_leave(&streams[s], nullptr, start + kernel_duration(s), kernel_region);
+    }
+  }
+  htf_write_streams_close(streams, nb_streams);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "streams_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  htf_assert(trace.nb_threads == (int)nb_streams);
+
+  for (int i = 0; i < trace.nb_threads; i++) {
+    Thread* thread = trace.threads[i];
+    unsigned s = thread->id;
+    auto reader = ThreadReader(&trace, thread->id, ThreadReaderOptions::None);
+    int nb_events = 0;
+    while (reader.current_frame >= 0) {
+      Token token = reader.getCurToken();
+      Occurence* occurence = reader.getOccurence(token, reader.tokenCount[token]);
+      reader.updateReadCurToken();
+      if (token.type != TypeEvent)
+        continue;
+      reader.moveToNextToken();
+
+      // The timestamps are read relatively to the first Event of the Thread.
+      int k = nb_events / 2;
+      bool is_enter = nb_events % 2 == 0;
+      EventOccurence* e = &occurence->event_occurence;
+      htf_timestamp_t expected = k * period(s) + (is_enter ? 0 : kernel_duration(s));
+      htf_assert(e->event->record == (is_enter ? HTF_EVENT_ENTER : HTF_EVENT_LEAVE));
+      htf_assert(e->timestamp == expected);
+      if (is_enter)
+        htf_assert(e->duration == kernel_duration(s));
+      else if (k < nb_kernels - 1)
+        htf_assert(e->duration == period(s) - kernel_duration(s));
+      nb_events++;
+    }
+    htf_assert(nb_events == 2 * nb_kernels);
+  }
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records rounds of short-lived threads with ThreadWriters taken from the ThreadWriterPool.
+ *
+ * Each thread of each round gets its own Location, unless HTF_POOL_LOGICAL_LOCATIONS is set: the threads then share
+ * at most as many logical Locations as there are threads in a round. Either way, every call must be in the trace.
+ */
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_parameter_handler.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static const int nb_threads_per_round = 4;
+static const int nb_rounds = 50;
+static const RegionRef task_region = 0;
+static const StringRef worker_name = 1;
+
+static Archive* global_archive;
+static Archive* archive;
+
+/** Body of a short-lived thread: records `nb_calls` calls of the task Region. */
+static void worker(ThreadId thread_id, int nb_calls) {
+  ThreadWriter* thread_writer = htf_thread_writer_acquire(archive, thread_id, global_archive, worker_name, 0);
+  for (int i = 0; i < nb_calls; i++) {
+    htf_record_enter(thread_writer, nullptr, HTF_TIMESTAMP_INVALID, task_region);
+    htf_record_leave(thread_writer, nullptr, HTF_TIMESTAMP_INVALID, task_region);
+  }
+  htf_thread_writer_release(thread_writer);
+}
+
+int main(int argc, char** argv) {
+  int nb_calls = argc > 1 ? atoi(argv[1]) : 100;
+
+  global_archive = htf_archive_new();
+  archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "thread_pool_trace", "main");
+  htf_write_archive_open(archive, "thread_pool_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, worker_name, "worker");
+  htf_archive_register_string(global_archive, 2, "task");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_archive_register_region(archive, task_region, 2);
+
+  ThreadId next_thread_id = 0;
+  for (int round = 0; round < nb_rounds; round++) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nb_threads_per_round; i++)
+      threads.emplace_back(worker, next_thread_id++, nb_calls);
+    for (auto& t : threads)
+      t.join();
+  }
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  char trace_name[] = "thread_pool_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  if (parameterHandler.getPoolLogicalLocations())
+    htf_assert(trace.nb_threads <= nb_threads_per_round);
+  else
+    htf_assert(trace.nb_threads == nb_rounds * nb_threads_per_round);
+
+  size_t nb_enters = 0;
+  for (int i = 0; i < trace.nb_threads; i++) {
+    Thread* thread = trace.threads[i];
+    for (auto& [id, payload] : decodeEvents<EnterRecord>(thread)) {
+      htf_assert(payload.region_ref == task_region);
+      nb_enters += thread->events[id].nb_occurences;
+    }
+  }
+  htf_assert(nb_enters == (size_t)nb_rounds * nb_threads_per_round * nb_calls);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
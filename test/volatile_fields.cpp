@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) Telecom SudParis
+ * See LICENSE in top-level directory.
+ */
+/* Records non-blocking MPI calls whose request ids and message lengths change at every call.
+ *
+ * With HTF_VOLATILE_FIELDS=RequestID,MessageLength, these fields are kept out of the Events,
+ * so each kind of call is only one Event and the calls form a Loop. Reading the trace back
+ * must still give the values of each call.
+ */
+#include <cstdlib>
+#include "htf/htf.h"
+#include "htf/htf_archive.h"
+#include "htf/htf_read.h"
+#include "htf/htf_record.h"
+#include "htf/htf_storage.h"
+#include "htf/htf_write.h"
+
+using namespace htf;
+
+static int nb_iterations_default = 100;
+
+int main(int argc, char** argv) {
+  int nb_iterations = argc > 1 ? atoi(argv[1]) : nb_iterations_default;
+  uint32_t volatile_fields = (uint32_t)VolatileField::RequestID | (uint32_t)VolatileField::MessageLength;
+  htf_assert(parameterHandler.getVolatileFields() == volatile_fields);
+
+  Archive* global_archive = htf_archive_new();
+  Archive* archive = htf_archive_new();
+  htf_write_global_archive_open(global_archive, "volatile_fields_trace", "main");
+  htf_write_archive_open(archive, "volatile_fields_trace", "main", 0);
+  htf_archive_register_string(global_archive, 0, "Process");
+  htf_archive_register_string(global_archive, 1, "thread_0");
+  htf_write_define_location_group(global_archive, 0, 0, HTF_LOCATION_GROUP_ID_INVALID);
+  htf_write_define_location(global_archive, 0, 1, 0);
+
+  auto* thread_writer = new ThreadWriter();
+  htf_write_thread_open(archive, thread_writer, 0);
+  htf_timestamp_t ts = 1;
+  for (int i = 0; i < nb_iterations; i++) {
+    htf_record_mpi_isend(thread_writer, nullptr, ts++, 1, 0, 42, 8 * i, 2 * i);
+    htf_record_mpi_irecv(thread_writer, nullptr, ts++, 1, 0, 42, 8 * i, 2 * i + 1);
+    htf_record_mpi_isend_complete(thread_writer, nullptr, ts++, 2 * i);
+  }
+
+  /* The request ids and the message lengths are not part of the Events anymore. */
+  htf_assert(thread_writer->thread_trace.nb_events == 3);
+  htf_assert(thread_writer->thread_trace.nb_loops == 1);
+  htf_write_thread_close(thread_writer);
+  htf_write_archive_close(archive);
+  htf_write_global_archive_close(global_archive);
+
+  /* Each occurence still has its own values. */
+  char trace_name[] = "volatile_fields_trace/main.htf";
+  auto trace = Archive();
+  htf_read_archive(&trace, trace_name);
+  auto reader = ThreadReader(&trace, trace.threads[0]->id, ThreadReaderOptions::None);
+  int nb_isend = 0;
+  int nb_irecv = 0;
+  int nb_complete = 0;
+  while (reader.current_frame >= 0) {
+    Token token = reader.getCurToken();
+    Occurence* occurence = reader.getOccurence(token, reader.tokenCount[token]);
+    reader.updateReadCurToken();
+    if (token.type != TypeEvent)
+      continue;
+    reader.moveToNextToken();
+
+    EventOccurence* e = &occurence->event_occurence;
+    htf_assert(e->volatile_values != nullptr);
+    Event event = *e->event;
+    restoreVolatileFields(&event, reader.thread_trace->getEventSummary(token)->volatile_fields, e->volatile_values);
+    switch (event.record) {
+    case HTF_EVENT_MPI_ISEND: {
+      auto payload = decodeEvent<MpiIsendRecord>(&event);
+      htf_assert(payload.msgTag == 42);
+      htf_assert(payload.msgLength == (uint64_t)8 * nb_isend);
+      htf_assert(payload.requestID == (uint64_t)2 * nb_isend);
+      nb_isend++;
+      break;
+    }
+    case HTF_EVENT_MPI_IRECV: {
+      auto payload = decodeEvent<MpiIrecvRecord>(&event);
+      htf_assert(payload.msgLength == (uint64_t)8 * nb_irecv);
+      htf_assert(payload.requestID == (uint64_t)2 * nb_irecv + 1);
+      nb_irecv++;
+      break;
+    }
+    case HTF_EVENT_MPI_ISEND_COMPLETE: {
+      auto payload = decodeEvent<MpiIsendCompleteRecord>(&event);
+      htf_assert(payload.requestID == (uint64_t)2 * nb_complete);
+      nb_complete++;
+      break;
+    }
+    default:
+      htf_error("Unexpected event %d\n", event.record);
+    }
+  }
+  htf_assert(nb_isend == nb_iterations && nb_irecv == nb_iterations && nb_complete == nb_iterations);
+  return EXIT_SUCCESS;
+}
+
+/* -*-
+   mode: c++;
+   c-file-style: "k&r";
+   c-basic-offset 2;
+   tab-width 2 ;
+   indent-tabs-mode nil
+   -*- */
@@ -2,6 +2,7 @@
  * Copyright (C) Telecom SudParis
  * See LICENSE in top-level directory.
  */
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,7 @@ static int nb_functions;
 static int nb_threads;
 static int pattern;
 static int use_logical_clock;
+static int crash;
 
 struct ThreadWriter** thread_writers;
 static RegionRef* regions;
@@ -135,6 +137,7 @@ void usage(const char* prog_name) {
   printf("\t-t X    Set the number of threads (default: %d)\n", nb_threads_default);
   printf("\t-p X    Select the event pattern\n");
   printf("\t-l      Use a per-thread logical clock instead of the default clock (default: %d)\n", use_logical_clock_default);
+  printf("\t-k      Kill the process once all the events are recorded, before the trace is closed\n");
 
   printf("\t-? -h   Display this help and exit\n");
 }
@@ -167,6 +170,9 @@ int main(int argc, char** argv) {
     } else if (!strcmp(argv[i], "-l")) {
       use_logical_clock = 1;
       nb_opts += 1;
+    } else if (!strcmp(argv[i], "-k")) {
+      crash = 1;
+      nb_opts += 1;
     } else if (!strcmp(argv[i], "-?") || !strcmp(argv[i], "-h")) {
       usage(argv[0]);
       return EXIT_SUCCESS;
@@ -218,6 +224,8 @@ int main(int argc, char** argv) {
   clock_gettime(CLOCK_MONOTONIC, &t1);
   pthread_barrier_wait(&bench_stop);
   clock_gettime(CLOCK_MONOTONIC, &t2);
+  if (crash)
+    raise(SIGKILL);
 
   for (int i = 0; i < nb_threads; i++)
     pthread_join(tid[i], NULL);